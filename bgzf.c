@@ -0,0 +1,679 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "bgzf.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+
+
+static uint32_t bgzf_le32(const unsigned char *b) {
+  return ((uint32_t)b[0]) | ((uint32_t)b[1] << 8) |
+    ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+
+static void bgzf_put_le16(unsigned char *b, uint16_t x) {
+  b[0] = x & 0xff;
+  b[1] = (x >> 8) & 0xff;
+}
+
+
+static void bgzf_put_le32(unsigned char *b, uint32_t x) {
+  b[0] = x & 0xff;
+  b[1] = (x >> 8) & 0xff;
+  b[2] = (x >> 16) & 0xff;
+  b[3] = (x >> 24) & 0xff;
+}
+
+
+/**
+ * Returns TRUE if the header of the provided block looks like a
+ * BGZF block header: a gzip header with the FEXTRA flag set and a
+ * 'BC' extra subfield holding the block size.
+ */
+static int bgzf_is_block_header(const unsigned char *hdr) {
+  return (hdr[0] == 31 && hdr[1] == 139 && hdr[2] == 8 &&
+	  (hdr[3] & 4) && hdr[12] == 'B' && hdr[13] == 'C' &&
+	  hdr[14] == 2 && hdr[15] == 0);
+}
+
+
+/**
+ * Returns TRUE if the file with the provided path is BGZF
+ * compressed, FALSE otherwise.
+ */
+int bgzf_is_bgzf(const char *path) {
+  unsigned char hdr[BGZF_BLOCK_HEADER_LEN];
+  FILE *fh;
+  size_t n;
+
+  fh = util_must_fopen(path, "rb");
+  n = fread(hdr, 1, sizeof(hdr), fh);
+  fclose(fh);
+
+  return (n == sizeof(hdr)) && bgzf_is_block_header(hdr);
+}
+
+
+/**
+ * Returns number of decompression threads to use by default, which
+ * is the number of online processors.
+ */
+int bgzf_default_threads() {
+  long n;
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n < 1) ? 1 : n;
+}
+
+
+
+/**
+ * Reads the next compressed block from the file into the provided
+ * block. Returns FALSE if at EOF, TRUE otherwise.
+ */
+static int bgzf_read_comp_block(BGZFReader *bgzf, BGZFBlock *blk) {
+  unsigned char *hdr;
+  size_t n;
+  int bsize;
+
+  hdr = blk->comp;
+  n = fread(hdr, 1, BGZF_BLOCK_HEADER_LEN, bgzf->fh);
+
+  if(n == 0) {
+    if(ferror(bgzf->fh)) {
+      my_err("%s:%d: error reading file '%s'", __FILE__, __LINE__,
+	     bgzf->path);
+    }
+    return FALSE;
+  }
+  if(n < BGZF_BLOCK_HEADER_LEN || !bgzf_is_block_header(hdr)) {
+    my_err("%s:%d: invalid BGZF block header at offset %lld of file '%s'",
+	   __FILE__, __LINE__, (long long)bgzf->coffset, bgzf->path);
+  }
+
+  bsize = (hdr[16] | (hdr[17] << 8)) + 1;
+  if(bsize < BGZF_BLOCK_HEADER_LEN + 8) {
+    my_err("%s:%d: invalid BGZF block size (%d) at offset %lld of file '%s'",
+	   __FILE__, __LINE__, bsize, (long long)bgzf->coffset, bgzf->path);
+  }
+
+  n = fread(&hdr[BGZF_BLOCK_HEADER_LEN], 1,
+	    bsize - BGZF_BLOCK_HEADER_LEN, bgzf->fh);
+  if(n != bsize - BGZF_BLOCK_HEADER_LEN) {
+    my_err("%s:%d: truncated BGZF block at offset %lld of file '%s'",
+	   __FILE__, __LINE__, (long long)bgzf->coffset, bgzf->path);
+  }
+
+  blk->coffset = bgzf->coffset;
+  blk->comp_len = bsize;
+  bgzf->coffset += bsize;
+
+  return TRUE;
+}
+
+
+
+/**
+ * Inflates the compressed data in the block and checks it against
+ * the CRC and length stored in the block footer. Returns TRUE on
+ * success, FALSE if the block is corrupt.
+ */
+static int bgzf_inflate_block(z_stream *zs, BGZFBlock *blk) {
+  const unsigned char *footer;
+  uint32_t crc, isize;
+
+  footer = &blk->comp[blk->comp_len - 8];
+  crc = bgzf_le32(footer);
+  isize = bgzf_le32(&footer[4]);
+
+  if(inflateReset(zs) != Z_OK) {
+    return FALSE;
+  }
+  zs->next_in = &blk->comp[BGZF_BLOCK_HEADER_LEN];
+  zs->avail_in = blk->comp_len - BGZF_BLOCK_HEADER_LEN - 8;
+  zs->next_out = (unsigned char *)blk->data;
+  zs->avail_out = BGZF_MAX_BLOCK_SIZE;
+
+  if(inflate(zs, Z_FINISH) != Z_STREAM_END) {
+    return FALSE;
+  }
+  blk->data_len = BGZF_MAX_BLOCK_SIZE - zs->avail_out;
+
+  if(blk->data_len != isize ||
+     crc32(crc32(0L, NULL, 0), (unsigned char *)blk->data,
+	   blk->data_len) != crc) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+static void bgzf_inflate_init(z_stream *zs) {
+  memset(zs, 0, sizeof(z_stream));
+  /* negative window bits indicates raw deflate stream without header */
+  if(inflateInit2(zs, -15) != Z_OK) {
+    my_err("%s:%d: could not initialize zlib: %s", __FILE__, __LINE__,
+	   zs->msg ? zs->msg : "");
+  }
+}
+
+
+
+/**
+ * Worker thread: takes pending blocks off the ring in order,
+ * inflates them and marks them as done.
+ */
+static void *bgzf_worker(void *data) {
+  BGZFReader *bgzf;
+  BGZFBlock *blk;
+  z_stream zs;
+  int ok;
+
+  bgzf = data;
+  bgzf_inflate_init(&zs);
+
+  pthread_mutex_lock(&bgzf->lock);
+  while(TRUE) {
+    while(!bgzf->shutdown && bgzf->next_job == bgzf->tail) {
+      pthread_cond_wait(&bgzf->job_cond, &bgzf->lock);
+    }
+    if(bgzf->shutdown) {
+      break;
+    }
+
+    blk = &bgzf->blocks[bgzf->next_job % bgzf->n_block];
+    blk->state = BGZF_BLOCK_BUSY;
+    bgzf->next_job += 1;
+    pthread_mutex_unlock(&bgzf->lock);
+
+    ok = bgzf_inflate_block(&zs, blk);
+
+    pthread_mutex_lock(&bgzf->lock);
+    blk->state = ok ? BGZF_BLOCK_DONE : BGZF_BLOCK_ERROR;
+    pthread_cond_broadcast(&bgzf->done_cond);
+  }
+  pthread_mutex_unlock(&bgzf->lock);
+
+  inflateEnd(&zs);
+
+  return NULL;
+}
+
+
+
+/**
+ * Opens a BGZF file for reading. If n_threads is greater than 0
+ * that many worker threads are started to inflate blocks, otherwise
+ * blocks are inflated by the calling thread.
+ */
+BGZFReader *bgzf_reader_open(const char *path, int n_threads) {
+  BGZFReader *bgzf;
+  int i;
+
+  bgzf = my_new(BGZFReader, 1);
+  bgzf->fh = util_must_fopen(path, "rb");
+  bgzf->path = util_str_dup(path);
+  bgzf->coffset = 0;
+  bgzf->at_eof = FALSE;
+
+  bgzf->n_threads = (n_threads > 0) ? n_threads : 0;
+  bgzf->n_block = (n_threads > 0) ? n_threads * BGZF_BLOCKS_PER_THREAD : 1;
+  bgzf->blocks = my_new(BGZFBlock, bgzf->n_block);
+  for(i = 0; i < bgzf->n_block; i++) {
+    bgzf->blocks[i].state = BGZF_BLOCK_EMPTY;
+  }
+  bgzf->head = bgzf->next_job = bgzf->tail = 0;
+  bgzf->holding_head = FALSE;
+  bgzf->shutdown = FALSE;
+
+  if(bgzf->n_threads == 0) {
+    bgzf_inflate_init(&bgzf->zs);
+    bgzf->threads = NULL;
+    return bgzf;
+  }
+
+  pthread_mutex_init(&bgzf->lock, NULL);
+  pthread_cond_init(&bgzf->job_cond, NULL);
+  pthread_cond_init(&bgzf->done_cond, NULL);
+
+  bgzf->threads = my_new(pthread_t, bgzf->n_threads);
+  for(i = 0; i < bgzf->n_threads; i++) {
+    if(pthread_create(&bgzf->threads[i], NULL, bgzf_worker, bgzf) != 0) {
+      my_err("%s:%d: could not create thread", __FILE__, __LINE__);
+    }
+  }
+
+  return bgzf;
+}
+
+
+
+void bgzf_reader_close(BGZFReader *bgzf) {
+  int i;
+
+  if(bgzf->n_threads > 0) {
+    pthread_mutex_lock(&bgzf->lock);
+    bgzf->shutdown = TRUE;
+    pthread_cond_broadcast(&bgzf->job_cond);
+    pthread_mutex_unlock(&bgzf->lock);
+
+    for(i = 0; i < bgzf->n_threads; i++) {
+      pthread_join(bgzf->threads[i], NULL);
+    }
+    my_free(bgzf->threads);
+
+    pthread_mutex_destroy(&bgzf->lock);
+    pthread_cond_destroy(&bgzf->job_cond);
+    pthread_cond_destroy(&bgzf->done_cond);
+  } else {
+    inflateEnd(&bgzf->zs);
+  }
+
+  fclose(bgzf->fh);
+  my_free(bgzf->path);
+  my_free(bgzf->blocks);
+  my_free(bgzf);
+}
+
+
+
+/**
+ * Returns the next decompressed block from the file, or NULL if at
+ * EOF. The returned block is only valid until the next call to
+ * this function.
+ */
+BGZFBlock *bgzf_read_block(BGZFReader *bgzf) {
+  BGZFBlock *blk;
+
+  if(bgzf->n_threads == 0) {
+    /* no worker threads, inflate block ourselves */
+    blk = &bgzf->blocks[0];
+    if(!bgzf_read_comp_block(bgzf, blk)) {
+      bgzf->at_eof = TRUE;
+      return NULL;
+    }
+    if(!bgzf_inflate_block(&bgzf->zs, blk)) {
+      my_err("%s:%d: corrupt BGZF block at offset %lld of file '%s'",
+	     __FILE__, __LINE__, (long long)blk->coffset, bgzf->path);
+    }
+    return blk;
+  }
+
+  pthread_mutex_lock(&bgzf->lock);
+  if(bgzf->holding_head) {
+    /* release block that was previously returned */
+    bgzf->blocks[bgzf->head % bgzf->n_block].state = BGZF_BLOCK_EMPTY;
+    bgzf->head += 1;
+    bgzf->holding_head = FALSE;
+  }
+  pthread_mutex_unlock(&bgzf->lock);
+
+  /* top up ring with compressed blocks for workers to inflate */
+  while(!bgzf->at_eof && (bgzf->tail - bgzf->head) < bgzf->n_block) {
+    blk = &bgzf->blocks[bgzf->tail % bgzf->n_block];
+    if(!bgzf_read_comp_block(bgzf, blk)) {
+      bgzf->at_eof = TRUE;
+      break;
+    }
+    pthread_mutex_lock(&bgzf->lock);
+    blk->state = BGZF_BLOCK_PENDING;
+    bgzf->tail += 1;
+    pthread_cond_signal(&bgzf->job_cond);
+    pthread_mutex_unlock(&bgzf->lock);
+  }
+
+  if(bgzf->head == bgzf->tail) {
+    return NULL;
+  }
+
+  /* wait for block at head of ring to be inflated */
+  blk = &bgzf->blocks[bgzf->head % bgzf->n_block];
+  pthread_mutex_lock(&bgzf->lock);
+  while(blk->state != BGZF_BLOCK_DONE && blk->state != BGZF_BLOCK_ERROR) {
+    pthread_cond_wait(&bgzf->done_cond, &bgzf->lock);
+  }
+  bgzf->holding_head = TRUE;
+  pthread_mutex_unlock(&bgzf->lock);
+
+  if(blk->state == BGZF_BLOCK_ERROR) {
+    my_err("%s:%d: corrupt BGZF block at offset %lld of file '%s'",
+	   __FILE__, __LINE__, (long long)blk->coffset, bgzf->path);
+  }
+
+  return blk;
+}
+
+
+
+/**
+ * Moves the reader to the compressed block at the provided offset
+ * in the file. Blocks that have already been queued are discarded.
+ */
+void bgzf_reader_seek(BGZFReader *bgzf, int64_t coffset) {
+  int i;
+
+  if(bgzf->n_threads > 0) {
+    pthread_mutex_lock(&bgzf->lock);
+
+    /* cancel blocks that no worker has started on yet */
+    bgzf->tail = bgzf->next_job;
+
+    /* wait for workers to finish blocks they are inflating */
+    for(i = 0; i < bgzf->n_block; i++) {
+      while(bgzf->blocks[i].state == BGZF_BLOCK_BUSY) {
+	pthread_cond_wait(&bgzf->done_cond, &bgzf->lock);
+      }
+      bgzf->blocks[i].state = BGZF_BLOCK_EMPTY;
+    }
+    bgzf->head = bgzf->next_job = bgzf->tail = 0;
+    bgzf->holding_head = FALSE;
+
+    pthread_mutex_unlock(&bgzf->lock);
+  }
+
+  if(fseeko(bgzf->fh, coffset, SEEK_SET) != 0) {
+    my_err("%s:%d: could not seek to offset %lld of file '%s'",
+	   __FILE__, __LINE__, (long long)coffset, bgzf->path);
+  }
+  bgzf->coffset = coffset;
+  bgzf->at_eof = FALSE;
+}
+
+
+
+
+static void bgzf_deflate_init(z_stream *zs, int level) {
+  memset(zs, 0, sizeof(z_stream));
+  /* negative window bits gives raw deflate stream without header */
+  if(deflateInit2(zs, level, Z_DEFLATED, -15, 8,
+		  Z_DEFAULT_STRATEGY) != Z_OK) {
+    my_err("%s:%d: could not initialize zlib: %s", __FILE__, __LINE__,
+	   zs->msg ? zs->msg : "");
+  }
+}
+
+
+/**
+ * Compresses len bytes of data into a complete BGZF block (header,
+ * deflated data and footer) in comp. Returns the length of the block.
+ */
+static int bgzf_deflate_block(z_stream *zs, const char *data, int len,
+			      unsigned char *comp) {
+  static const unsigned char header[BGZF_BLOCK_HEADER_LEN] =
+    {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+  int comp_len;
+
+  if(deflateReset(zs) != Z_OK) {
+    my_err("%s:%d: could not reset zlib", __FILE__, __LINE__);
+  }
+  zs->next_in = (unsigned char *)data;
+  zs->avail_in = len;
+  zs->next_out = &comp[BGZF_BLOCK_HEADER_LEN];
+  zs->avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_BLOCK_HEADER_LEN - 8;
+
+  if(deflate(zs, Z_FINISH) != Z_STREAM_END) {
+    my_err("%s:%d: could not compress BGZF block", __FILE__, __LINE__);
+  }
+  comp_len = BGZF_MAX_BLOCK_SIZE - 8 - zs->avail_out;
+
+  memcpy(comp, header, BGZF_BLOCK_HEADER_LEN);
+  bgzf_put_le16(&comp[16], comp_len + 8 - 1);
+  bgzf_put_le32(&comp[comp_len],
+		crc32(crc32(0L, NULL, 0), (unsigned char *)data, len));
+  bgzf_put_le32(&comp[comp_len + 4], len);
+
+  return comp_len + 8;
+}
+
+
+
+/**
+ * Worker thread: takes pending blocks off the writer's ring in
+ * order, deflates them and marks them as done.
+ */
+static void *bgzf_deflate_worker(void *data) {
+  BGZFWriter *w;
+  BGZFBlock *blk;
+  z_stream zs;
+
+  w = data;
+  bgzf_deflate_init(&zs, w->level);
+
+  pthread_mutex_lock(&w->lock);
+  while(TRUE) {
+    while(!w->shutdown && w->next_job == w->tail) {
+      pthread_cond_wait(&w->job_cond, &w->lock);
+    }
+    if(w->shutdown) {
+      break;
+    }
+
+    blk = &w->blocks[w->next_job % w->n_block];
+    blk->state = BGZF_BLOCK_BUSY;
+    w->next_job += 1;
+    pthread_mutex_unlock(&w->lock);
+
+    blk->comp_len = bgzf_deflate_block(&zs, blk->data, blk->data_len,
+				       blk->comp);
+
+    pthread_mutex_lock(&w->lock);
+    blk->state = BGZF_BLOCK_DONE;
+    pthread_cond_broadcast(&w->done_cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  deflateEnd(&zs);
+
+  return NULL;
+}
+
+
+
+/**
+ * Opens a file for writing in BGZF format with the provided
+ * compression level (0-9, or -1 for the zlib default). If n_threads
+ * is greater than 0 that many worker threads are started to deflate
+ * blocks, otherwise blocks are deflated by the calling thread.
+ */
+BGZFWriter *bgzf_writer_open(const char *path, int level, int n_threads) {
+  BGZFWriter *w;
+  int i;
+
+  w = my_new(BGZFWriter, 1);
+  w->fh = util_must_fopen(path, "wb");
+  w->path = util_str_dup(path);
+  w->level = level;
+  w->coffset = 0;
+  w->data_len = 0;
+  bgzf_deflate_init(&w->zs, level);
+
+  w->n_threads = (n_threads > 0) ? n_threads : 0;
+  w->head = w->next_job = w->tail = 0;
+  w->shutdown = FALSE;
+
+  if(w->n_threads == 0) {
+    w->n_block = 0;
+    w->blocks = NULL;
+    w->threads = NULL;
+    return w;
+  }
+
+  w->n_block = w->n_threads * BGZF_BLOCKS_PER_THREAD;
+  w->blocks = my_new(BGZFBlock, w->n_block);
+  for(i = 0; i < w->n_block; i++) {
+    w->blocks[i].state = BGZF_BLOCK_EMPTY;
+  }
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->job_cond, NULL);
+  pthread_cond_init(&w->done_cond, NULL);
+
+  w->threads = my_new(pthread_t, w->n_threads);
+  for(i = 0; i < w->n_threads; i++) {
+    if(pthread_create(&w->threads[i], NULL, bgzf_deflate_worker, w) != 0) {
+      my_err("%s:%d: could not create thread", __FILE__, __LINE__);
+    }
+  }
+
+  return w;
+}
+
+
+/**
+ * Writes deflated blocks at the head of the ring to the file. If
+ * wait is TRUE, waits for blocks until the ring is empty, otherwise
+ * stops at the first block that has not been deflated yet.
+ */
+static void bgzf_write_done(BGZFWriter *w, int wait) {
+  BGZFBlock *blk;
+  int state;
+
+  while(w->head < w->tail) {
+    blk = &w->blocks[w->head % w->n_block];
+
+    pthread_mutex_lock(&w->lock);
+    while(wait && blk->state != BGZF_BLOCK_DONE) {
+      pthread_cond_wait(&w->done_cond, &w->lock);
+    }
+    state = blk->state;
+    pthread_mutex_unlock(&w->lock);
+    if(state != BGZF_BLOCK_DONE) {
+      break;
+    }
+
+    /* block is not touched by workers again until it is requeued */
+    util_must_fwrite(w->fh, blk->comp, blk->comp_len);
+    w->coffset += blk->comp_len;
+    blk->state = BGZF_BLOCK_EMPTY;
+    w->head += 1;
+  }
+}
+
+
+/**
+ * Copies data into the next free block of the ring and queues it
+ * for a worker to deflate. Blocks are written to the file in the
+ * order they were queued.
+ */
+static void bgzf_queue_block(BGZFWriter *w, const char *data, int len) {
+  BGZFBlock *blk;
+
+  if(w->tail - w->head >= w->n_block) {
+    /* ring is full, wait for oldest block */
+    pthread_mutex_lock(&w->lock);
+    blk = &w->blocks[w->head % w->n_block];
+    while(blk->state != BGZF_BLOCK_DONE) {
+      pthread_cond_wait(&w->done_cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+  }
+  bgzf_write_done(w, FALSE);
+
+  blk = &w->blocks[w->tail % w->n_block];
+  memcpy(blk->data, data, len);
+  blk->data_len = len;
+
+  pthread_mutex_lock(&w->lock);
+  blk->state = BGZF_BLOCK_PENDING;
+  w->tail += 1;
+  pthread_cond_signal(&w->job_cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+static void bgzf_write_block(BGZFWriter *w, const char *data, int len) {
+  int comp_len;
+
+  if(w->n_threads > 0) {
+    bgzf_queue_block(w, data, len);
+    return;
+  }
+
+  comp_len = bgzf_deflate_block(&w->zs, data, len, w->comp);
+  util_must_fwrite(w->fh, w->comp, comp_len);
+  w->coffset += comp_len;
+}
+
+
+/**
+ * Compresses and writes any buffered data as a block. Data that is
+ * written after a flush starts in a new block.
+ */
+void bgzf_flush(BGZFWriter *w) {
+  if(w->data_len > 0) {
+    bgzf_write_block(w, w->data, w->data_len);
+    w->data_len = 0;
+  }
+}
+
+
+/**
+ * Writes len bytes of data, which are compressed a block at a time.
+ */
+void bgzf_write(BGZFWriter *w, const void *data, size_t len) {
+  const char *d;
+  size_t n;
+
+  d = data;
+  while(len > 0) {
+    n = BGZF_BLOCK_DATA_SIZE - w->data_len;
+    if(n > len) {
+      n = len;
+    }
+    memcpy(&w->data[w->data_len], d, n);
+    w->data_len += n;
+    d += n;
+    len -= n;
+
+    if(w->data_len == BGZF_BLOCK_DATA_SIZE) {
+      bgzf_flush(w);
+    }
+  }
+}
+
+
+/**
+ * Flushes remaining data, writes the empty block that marks the end
+ * of a BGZF file and closes the file.
+ */
+void bgzf_writer_close(BGZFWriter *w) {
+  int i;
+
+  bgzf_flush(w);
+  bgzf_write_block(w, w->data, 0);
+
+  if(w->n_threads > 0) {
+    bgzf_write_done(w, TRUE);
+
+    pthread_mutex_lock(&w->lock);
+    w->shutdown = TRUE;
+    pthread_cond_broadcast(&w->job_cond);
+    pthread_mutex_unlock(&w->lock);
+
+    for(i = 0; i < w->n_threads; i++) {
+      pthread_join(w->threads[i], NULL);
+    }
+    my_free(w->threads);
+    my_free(w->blocks);
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->job_cond);
+    pthread_cond_destroy(&w->done_cond);
+  }
+
+  if(fclose(w->fh) != 0) {
+    my_err("%s:%d: error closing file '%s'", __FILE__, __LINE__, w->path);
+  }
+  deflateEnd(&w->zs);
+  my_free(w->path);
+  my_free(w);
+}
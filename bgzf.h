@@ -0,0 +1,136 @@
+#ifndef __BGZF_H__
+#define __BGZF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <zlib.h>
+
+/* maximum size of a BGZF block, compressed or uncompressed */
+#define BGZF_MAX_BLOCK_SIZE 65536
+#define BGZF_BLOCK_HEADER_LEN 18
+
+/* amount of uncompressed data written to each block, which leaves
+ * room for deflate to expand incompressible data
+ */
+#define BGZF_BLOCK_DATA_SIZE 0xff00
+
+/* number of blocks queued per worker thread */
+#define BGZF_BLOCKS_PER_THREAD 4
+
+#define BGZF_BLOCK_EMPTY 0
+#define BGZF_BLOCK_PENDING 1
+#define BGZF_BLOCK_BUSY 2
+#define BGZF_BLOCK_DONE 3
+#define BGZF_BLOCK_ERROR 4
+
+
+typedef struct {
+  int state;
+
+  /* offset of this block in the compressed file */
+  int64_t coffset;
+
+  int comp_len;
+  unsigned char comp[BGZF_MAX_BLOCK_SIZE];
+
+  int data_len;
+  char data[BGZF_MAX_BLOCK_SIZE];
+} BGZFBlock;
+
+
+/**
+ * Reads a BGZF file. Compressed blocks are read from the file by the
+ * consumer and placed in a ring; worker threads inflate them in
+ * parallel and the consumer takes decompressed blocks off the ring
+ * in file order.
+ */
+typedef struct {
+  FILE *fh;
+  char *path;
+
+  /* offset in file of next compressed block to read */
+  int64_t coffset;
+  int at_eof;
+
+  int n_threads;
+  pthread_t *threads;
+
+  /* used to inflate blocks when there are no worker threads */
+  z_stream zs;
+
+  /* ring of blocks, indexed by sequence number modulo n_block.
+   * head is the block held by the consumer, next_job is the next block
+   * to be taken by a worker, tail is next block to be read from file
+   */
+  int n_block;
+  BGZFBlock *blocks;
+  long head;
+  long next_job;
+  long tail;
+  int holding_head;
+
+  int shutdown;
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond;
+  pthread_cond_t done_cond;
+} BGZFReader;
+
+
+/**
+ * Writes a BGZF file. Data is collected into blocks, which are
+ * deflated either by the calling thread or, if there are worker
+ * threads, placed in a ring and deflated in parallel. Deflated
+ * blocks are written to the file in order by the calling thread.
+ */
+typedef struct {
+  FILE *fh;
+  char *path;
+  int level;
+
+  /* offset in file of the next block to be written */
+  int64_t coffset;
+
+  /* used to deflate blocks when there are no worker threads */
+  z_stream zs;
+
+  int data_len;
+  char data[BGZF_BLOCK_DATA_SIZE];
+  unsigned char comp[BGZF_MAX_BLOCK_SIZE];
+
+  int n_threads;
+  pthread_t *threads;
+
+  /* ring of blocks, indexed by sequence number modulo n_block.
+   * head is the next block to be written to the file, next_job is
+   * the next block to be taken by a worker, tail is the next block
+   * to be filled
+   */
+  int n_block;
+  BGZFBlock *blocks;
+  long head;
+  long next_job;
+  long tail;
+
+  int shutdown;
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond;
+  pthread_cond_t done_cond;
+} BGZFWriter;
+
+
+
+int bgzf_is_bgzf(const char *path);
+int bgzf_default_threads();
+
+BGZFReader *bgzf_reader_open(const char *path, int n_threads);
+void bgzf_reader_close(BGZFReader *bgzf);
+BGZFBlock *bgzf_read_block(BGZFReader *bgzf);
+void bgzf_reader_seek(BGZFReader *bgzf, int64_t coffset);
+
+BGZFWriter *bgzf_writer_open(const char *path, int level, int n_threads);
+void bgzf_write(BGZFWriter *w, const void *data, size_t len);
+void bgzf_flush(BGZFWriter *w);
+void bgzf_writer_close(BGZFWriter *w);
+
+#endif
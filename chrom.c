@@ -202,3 +202,166 @@ void chrom_free(Chromosome *chrom) {
   my_free(chrom);
 }
 
+
+
+
+/**
+ * FNV-1a hash of a chromosome name
+ */
+static uint32_t chrom_hash(const char *name, size_t len) {
+  uint32_t h;
+  size_t i;
+
+  h = 2166136261u;
+  for(i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+
+ChromDict *chrom_dict_new() {
+  ChromDict *dict;
+  size_t i;
+
+  dict = my_new(ChromDict, 1);
+  dict->n = 0;
+  dict->max_n = CHROM_DICT_INIT_SIZE / 2;
+  dict->names = my_new(char *, dict->max_n);
+  dict->name_lens = my_new(size_t, dict->max_n);
+
+  dict->n_slot = CHROM_DICT_INIT_SIZE;
+  dict->slots = my_new(int, dict->n_slot);
+  dict->slot_hashes = my_new(uint32_t, dict->n_slot);
+  for(i = 0; i < dict->n_slot; i++) {
+    dict->slots[i] = -1;
+  }
+
+  return dict;
+}
+
+
+
+void chrom_dict_free(ChromDict *dict) {
+  int i;
+
+  for(i = 0; i < dict->n; i++) {
+    my_free(dict->names[i]);
+  }
+  my_free(dict->names);
+  my_free(dict->name_lens);
+  my_free(dict->slots);
+  my_free(dict->slot_hashes);
+  my_free(dict);
+}
+
+
+
+/**
+ * Returns the slot that holds name, or the empty slot where it
+ * would be inserted
+ */
+static size_t chrom_dict_find_slot(const ChromDict *dict, const char *name,
+				   size_t len, uint32_t h) {
+  size_t i, mask;
+  int id;
+
+  mask = dict->n_slot - 1;
+  i = h & mask;
+  while((id = dict->slots[i]) != -1) {
+    if(dict->slot_hashes[i] == h && dict->name_lens[id] == len &&
+       memcmp(dict->names[id], name, len) == 0) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+
+
+/**
+ * Doubles the number of slots and reinserts names
+ */
+static void chrom_dict_grow(ChromDict *dict) {
+  size_t i, n_old, j, mask;
+  int *old_slots;
+  uint32_t *old_hashes;
+
+  n_old = dict->n_slot;
+  old_slots = dict->slots;
+  old_hashes = dict->slot_hashes;
+
+  dict->n_slot *= 2;
+  dict->slots = my_new(int, dict->n_slot);
+  dict->slot_hashes = my_new(uint32_t, dict->n_slot);
+  for(i = 0; i < dict->n_slot; i++) {
+    dict->slots[i] = -1;
+  }
+
+  /* names are distinct, so only need to find empty slots */
+  mask = dict->n_slot - 1;
+  for(i = 0; i < n_old; i++) {
+    if(old_slots[i] != -1) {
+      j = old_hashes[i] & mask;
+      while(dict->slots[j] != -1) {
+	j = (j + 1) & mask;
+      }
+      dict->slots[j] = old_slots[i];
+      dict->slot_hashes[j] = old_hashes[i];
+    }
+  }
+
+  my_free(old_slots);
+  my_free(old_hashes);
+
+  dict->max_n = dict->n_slot / 2;
+  dict->names = my_realloc(dict->names, sizeof(char *) * dict->max_n);
+  dict->name_lens = my_realloc(dict->name_lens, sizeof(size_t) * dict->max_n);
+}
+
+
+
+/**
+ * Returns the ID of the chromosome name of length len (which does
+ * not need to be '\0'-terminated), adding a copy of it to the
+ * dictionary with the next free ID if it is not already present.
+ */
+int chrom_dict_add(ChromDict *dict, const char *name, size_t len) {
+  uint32_t h;
+  size_t i;
+  int id;
+
+  h = chrom_hash(name, len);
+  i = chrom_dict_find_slot(dict, name, len, h);
+  if(dict->slots[i] != -1) {
+    return dict->slots[i];
+  }
+
+  if(dict->n >= dict->max_n) {
+    chrom_dict_grow(dict);
+    i = chrom_dict_find_slot(dict, name, len, h);
+  }
+
+  id = dict->n;
+  dict->names[id] = util_str_ndup(name, len);
+  dict->name_lens[id] = len;
+  dict->slots[i] = id;
+  dict->slot_hashes[i] = h;
+  dict->n += 1;
+
+  return id;
+}
+
+
+
+/**
+ * Returns the ID of the chromosome name of length len, or -1 if it
+ * is not in the dictionary
+ */
+int chrom_dict_lookup(const ChromDict *dict, const char *name, size_t len) {
+  return dict->slots[chrom_dict_find_slot(dict, name, len,
+					  chrom_hash(name, len))];
+}
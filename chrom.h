@@ -1,6 +1,12 @@
 #ifndef __CHR_H__
 #define __CHR_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* initial number of hash table slots of a ChromDict, a power of 2 */
+#define CHROM_DICT_INIT_SIZE 64
+
 typedef struct {
   int id;
   char *name;
@@ -9,6 +15,25 @@ typedef struct {
 } Chromosome;
 
 
+/**
+ * Hash table that interns chromosome names, assigning each distinct
+ * name an integer ID (0, 1, 2, ... in order of insertion). Uses open
+ * addressing with linear probing, and is kept at most half full.
+ */
+typedef struct {
+  /* names[id] is name with that ID */
+  int n;
+  int max_n;
+  char **names;
+  size_t *name_lens;
+
+  /* slots[i] is ID of name in slot, or -1 if the slot is empty */
+  size_t n_slot;
+  int *slots;
+  uint32_t *slot_hashes;
+} ChromDict;
+
+
 Chromosome *chrom_guess_from_file(const char *filename,
 				  Chromosome *chroms,
 				  int n_chrom);
@@ -18,4 +43,9 @@ Chromosome *chrom_copy(const Chromosome *chrom);
 void chrom_free(Chromosome *chrom);
 Chromosome *chrom_read_file(const char *filename, int *n_chrom);
 
+ChromDict *chrom_dict_new();
+void chrom_dict_free(ChromDict *dict);
+int chrom_dict_add(ChromDict *dict, const char *name, size_t len);
+int chrom_dict_lookup(const ChromDict *dict, const char *name, size_t len);
+
 #endif
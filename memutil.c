@@ -66,3 +66,100 @@ void __MY_FREE(void *ptr, const char *filename, const int line_num) {
 
 
 
+static MyArenaBlock *my_arena_block_new(size_t size) {
+  MyArenaBlock *blk;
+
+  blk = my_new(MyArenaBlock, 1);
+  blk->data = my_malloc(size);
+  blk->size = size;
+  blk->used = 0;
+  blk->next = NULL;
+
+  return blk;
+}
+
+
+/**
+ * Creates an arena that allocates from blocks of block_size bytes
+ * (MY_ARENA_BLOCK_SZ if 0). Larger allocations get a block of their
+ * own.
+ */
+MyArena *my_arena_new(size_t block_size) {
+  MyArena *arena;
+
+  arena = my_new(MyArena, 1);
+  arena->block_size = (block_size > 0) ? block_size : MY_ARENA_BLOCK_SZ;
+  arena->first = my_arena_block_new(arena->block_size);
+  arena->cur = arena->first;
+
+  return arena;
+}
+
+
+/**
+ * Returns n_bytes of memory from the arena, aligned to MY_ARENA_ALIGN
+ * bytes. The memory is valid until the arena is reset or freed.
+ */
+void *my_arena_alloc(MyArena *arena, size_t n_bytes) {
+  MyArenaBlock *blk, *new_blk;
+  size_t off;
+
+  blk = arena->cur;
+  off = (blk->used + MY_ARENA_ALIGN - 1) & ~((size_t)MY_ARENA_ALIGN - 1);
+
+  while(off + n_bytes > blk->size) {
+    if(blk->next && n_bytes <= blk->next->size) {
+      /* reuse block that was kept by my_arena_reset */
+      blk = blk->next;
+    } else {
+      new_blk = my_arena_block_new((n_bytes > arena->block_size) ?
+				   n_bytes : arena->block_size);
+      new_blk->next = blk->next;
+      blk->next = new_blk;
+      blk = new_blk;
+    }
+    blk->used = 0;
+    off = 0;
+  }
+  arena->cur = blk;
+  blk->used = off + n_bytes;
+
+  return &blk->data[off];
+}
+
+
+/**
+ * Returns a '\0'-terminated copy of the first len characters of str
+ * that is allocated from the arena
+ */
+char *my_arena_strndup(MyArena *arena, const char *str, size_t len) {
+  char *copy;
+
+  copy = my_arena_alloc(arena, len + 1);
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  return copy;
+}
+
+
+/**
+ * Releases all memory allocated from the arena at once. Blocks are
+ * kept, so that later allocations do not need to call malloc.
+ */
+void my_arena_reset(MyArena *arena) {
+  arena->cur = arena->first;
+  arena->cur->used = 0;
+}
+
+
+void my_arena_free(MyArena *arena) {
+  MyArenaBlock *blk, *next;
+
+  for(blk = arena->first; blk != NULL; blk = next) {
+    next = blk->next;
+    my_free(blk->data);
+    my_free(blk);
+  }
+  my_free(arena);
+}
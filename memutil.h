@@ -6,12 +6,49 @@
 #include <stdlib.h>
 #include "err.h"
 
+/* default size of blocks that arenas allocate from */
+#define MY_ARENA_BLOCK_SZ (64 * 1024)
+
+/* alignment of memory returned by my_arena_alloc */
+#define MY_ARENA_ALIGN 16
+
+
+typedef struct MyArenaBlock_struct {
+  char *data;
+  size_t size;
+  size_t used;
+  struct MyArenaBlock_struct *next;
+} MyArenaBlock;
+
+
+/**
+ * Bump allocator for many small allocations that share a lifetime,
+ * such as the strings of the records in a batch. Allocation just
+ * advances a pointer within the current block, and my_arena_reset
+ * releases everything at once while keeping the blocks for reuse.
+ * Memory from an arena must not be passed to my_free.
+ */
+typedef struct {
+  size_t block_size;
+
+  /* blocks in order of use, allocations are made from cur */
+  MyArenaBlock *first;
+  MyArenaBlock *cur;
+} MyArena;
+
+
 
 void *my_malloc(size_t n_bytes);
 void *my_malloc0(size_t n_bytes);
 void *my_realloc(void *ptr, size_t n_bytes);
 void __MY_FREE(void *ptr, const char *filename, const int line_num);
 
+MyArena *my_arena_new(size_t block_size);
+void *my_arena_alloc(MyArena *arena, size_t n_bytes);
+char *my_arena_strndup(MyArena *arena, const char *str, size_t len);
+void my_arena_reset(MyArena *arena);
+void my_arena_free(MyArena *arena);
+
 #define my_new(struct_type, n) \
   ((struct_type *)my_malloc(sizeof(struct_type) * n))
 
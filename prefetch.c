@@ -0,0 +1,187 @@
+
+#include <pthread.h>
+
+#include "prefetch.h"
+#include "vcf.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+
+
+/**
+ * Producer thread: reads SNPs into free slots of the ring until the
+ * end of the file (or region) is reached.
+ */
+static void *prefetch_producer(void *data) {
+  Prefetch *pf;
+  SNP *snp;
+  int ret;
+
+  pf = data;
+
+  while(TRUE) {
+    pthread_mutex_lock(&pf->lock);
+    while(!pf->shutdown && (pf->tail - pf->head) >= pf->n_slot) {
+      pthread_cond_wait(&pf->not_full, &pf->lock);
+    }
+    if(pf->shutdown) {
+      pthread_mutex_unlock(&pf->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    /* slot at tail is not visible to consumer until tail is advanced */
+    snp = &pf->slots[pf->tail % pf->n_slot];
+    if(pf->region) {
+      ret = vcf_read_region_line(pf->rd, pf->vcf, pf->region, snp);
+    } else {
+      ret = vcf_read_line(pf->rd, pf->vcf, snp);
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    if(ret == -1) {
+      pf->at_eof = TRUE;
+    } else {
+      pf->tail += 1;
+    }
+    pthread_cond_signal(&pf->not_empty);
+    pthread_mutex_unlock(&pf->lock);
+
+    if(ret == -1) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+
+
+/**
+ * Starts a producer thread that reads SNPs from rd (restricted to
+ * region, if it is non-NULL) into a ring of n_slot SNPs. Genotype
+ * arrays are allocated for every slot, sized from the header that
+ * must already have been read into vcf. The reader and vcf must not
+ * be used by the caller until prefetch_free is called.
+ */
+Prefetch *prefetch_new(Reader *rd, VCFInfo *vcf, VCFRegion *region,
+		       int n_slot) {
+  Prefetch *pf;
+  int i;
+
+  if(n_slot < 2) {
+    my_err("%s:%d: prefetch ring must have at least 2 slots",
+	   __FILE__, __LINE__);
+  }
+
+  pf = my_new(Prefetch, 1);
+  pf->rd = rd;
+  pf->vcf = vcf;
+  pf->region = region;
+
+  /* records stay in the ring after the reader has moved on, so
+   * their fixed columns cannot be views into the reader's buffer
+   */
+  vcf_set_record_mode(vcf, VCF_RECORD_COPY);
+
+  pf->n_slot = n_slot;
+  pf->slots = my_new(SNP, n_slot);
+  for(i = 0; i < n_slot; i++) {
+    snp_init(&pf->slots[i]);
+    if(vcf->dosage_type == VCF_DOSAGE_NONE) {
+      pf->slots[i].geno_probs =
+	my_malloc(sizeof(float) * vcf->n_geno_prob_col);
+    } else {
+      /* dosages are read instead of genotype probabilities */
+      pf->slots[i].dosages =
+	my_malloc(vcf_dosage_size(vcf->dosage_type) * vcf->n_samples);
+    }
+    pf->slots[i].haplotypes = my_malloc(sizeof(char) * vcf->n_haplo_col);
+    pf->slots[i].unphased = my_malloc(SNP_UNPHASED_SIZE(vcf->n_samples));
+  }
+  pf->head = pf->tail = 0;
+  pf->holding_head = FALSE;
+  pf->at_eof = FALSE;
+  pf->shutdown = FALSE;
+
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->not_full, NULL);
+  pthread_cond_init(&pf->not_empty, NULL);
+
+  if(pthread_create(&pf->thread, NULL, prefetch_producer, pf) != 0) {
+    my_err("%s:%d: could not create thread", __FILE__, __LINE__);
+  }
+
+  return pf;
+}
+
+
+
+/**
+ * Returns the next SNP, waiting for the producer if necessary, or
+ * NULL if there are no more SNPs. The returned SNP is only valid
+ * until the next call to this function.
+ */
+SNP *prefetch_next(Prefetch *pf) {
+  SNP *snp;
+
+  pthread_mutex_lock(&pf->lock);
+
+  if(pf->holding_head) {
+    /* give slot of previous SNP back to producer */
+    pf->head += 1;
+    pf->holding_head = FALSE;
+    pthread_cond_signal(&pf->not_full);
+  }
+
+  while(pf->head == pf->tail && !pf->at_eof) {
+    pthread_cond_wait(&pf->not_empty, &pf->lock);
+  }
+
+  if(pf->head == pf->tail) {
+    snp = NULL;
+  } else {
+    snp = &pf->slots[pf->head % pf->n_slot];
+    pf->holding_head = TRUE;
+  }
+
+  pthread_mutex_unlock(&pf->lock);
+
+  return snp;
+}
+
+
+
+/**
+ * Stops the producer thread and frees the ring. The reader and
+ * VCFInfo are not freed.
+ */
+void prefetch_free(Prefetch *pf) {
+  int i;
+
+  pthread_mutex_lock(&pf->lock);
+  pf->shutdown = TRUE;
+  pthread_cond_signal(&pf->not_full);
+  pthread_mutex_unlock(&pf->lock);
+
+  pthread_join(pf->thread, NULL);
+
+  pthread_mutex_destroy(&pf->lock);
+  pthread_cond_destroy(&pf->not_full);
+  pthread_cond_destroy(&pf->not_empty);
+
+  for(i = 0; i < pf->n_slot; i++) {
+    if(pf->slots[i].geno_probs) {
+      my_free(pf->slots[i].geno_probs);
+    }
+    if(pf->slots[i].dosages) {
+      my_free(pf->slots[i].dosages);
+    }
+    my_free(pf->slots[i].haplotypes);
+    my_free(pf->slots[i].unphased);
+    snp_free_strs(&pf->slots[i]);
+  }
+  my_free(pf->slots);
+  my_free(pf);
+}
@@ -0,0 +1,46 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <pthread.h>
+
+#include "vcf.h"
+#include "snp.h"
+#include "reader.h"
+
+
+/**
+ * Reads and parses SNPs from a VCF on a separate producer thread into
+ * a bounded ring of SNP records, so that the consumer only has to
+ * take already-parsed records off the ring.
+ */
+typedef struct {
+  Reader *rd;
+  VCFInfo *vcf;
+  VCFRegion *region;
+
+  /* ring of SNPs, indexed by sequence number modulo n_slot. head is
+   * the next SNP for the consumer, tail is the next SNP the producer
+   * will fill
+   */
+  int n_slot;
+  SNP *slots;
+  long head;
+  long tail;
+  int holding_head;
+
+  int at_eof;
+  int shutdown;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
+} Prefetch;
+
+
+Prefetch *prefetch_new(Reader *rd, VCFInfo *vcf, VCFRegion *region,
+		       int n_slot);
+SNP *prefetch_next(Prefetch *pf);
+void prefetch_free(Prefetch *pf);
+
+#endif
@@ -0,0 +1,437 @@
+
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "reader.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+
+
+/**
+ * Creates a new reader that reads lines from an already-opened
+ * gzFile. The gzFile is not closed by reader_free.
+ */
+Reader *reader_new(gzFile gzf) {
+  Reader *rd;
+
+  rd = my_new(Reader, 1);
+  rd->gzf = gzf;
+  rd->own_gzf = FALSE;
+  rd->map = NULL;
+  rd->map_len = 0;
+  rd->bgzf = NULL;
+  rd->blk = NULL;
+  rd->blk_pos = 0;
+  rd->marks = NULL;
+  rd->n_mark = rd->max_mark = 0;
+
+  rd->buf_size = READER_BUF_SZ;
+  rd->buf = my_malloc(rd->buf_size);
+  rd->start = rd->end = rd->scan = 0;
+  rd->at_eof = FALSE;
+
+  return rd;
+}
+
+
+/**
+ * Memory-maps the file with the provided path if it is an
+ * uncompressed regular file. Returns FALSE (and leaves the reader
+ * unchanged) if the file is gzipped, empty or cannot be mapped, in
+ * which case it should be read through zlib instead.
+ */
+static int reader_map(Reader *rd, const char *path) {
+  struct stat st;
+  unsigned char magic[2];
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    return FALSE;
+  }
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+     (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b)) {
+    close(fd);
+    return FALSE;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  /* mapping remains valid after file is closed */
+  close(fd);
+  if(map == MAP_FAILED) {
+    return FALSE;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  rd->map = map;
+  rd->map_len = st.st_size;
+  return TRUE;
+}
+
+
+
+/**
+ * Opens the file with the provided path (which may or may not be
+ * gzipped) and returns a new reader for it. The file is closed
+ * when reader_free is called. If the file is BGZF compressed, blocks
+ * are inflated in parallel by n_threads worker threads (or by the
+ * calling thread if n_threads is 0). If the file is not compressed
+ * it is memory-mapped.
+ */
+Reader *reader_open(const char *path, int n_threads) {
+  Reader *rd;
+
+  if(bgzf_is_bgzf(path)) {
+    rd = reader_new(NULL);
+    rd->bgzf = bgzf_reader_open(path, n_threads);
+    rd->max_mark = READER_N_MARK_INIT;
+    rd->marks = my_new(ReaderMark, rd->max_mark);
+    return rd;
+  }
+
+  rd = reader_new(NULL);
+  if(reader_map(rd, path)) {
+    /* lines are not copied, so buffer is not needed */
+    my_free(rd->buf);
+    rd->buf = NULL;
+    rd->buf_size = 0;
+    return rd;
+  }
+
+  rd->gzf = util_must_gzopen(path, "rb");
+  rd->own_gzf = TRUE;
+
+  /* we do our own buffering, so give zlib a large
+   * input buffer and avoid copying through its output buffer
+   */
+  gzbuffer(rd->gzf, READER_BUF_SZ);
+
+  return rd;
+}
+
+
+void reader_free(Reader *rd) {
+  if(rd->own_gzf) {
+    gzclose(rd->gzf);
+  }
+  if(rd->bgzf) {
+    bgzf_reader_close(rd->bgzf);
+    my_free(rd->marks);
+  }
+  if(rd->map) {
+    munmap((void *)rd->map, rd->map_len);
+  }
+  if(rd->buf) {
+    my_free(rd->buf);
+  }
+  my_free(rd);
+}
+
+
+
+/**
+ * Records that data copied to position buf_pos in the buffer
+ * starts at the current position of the current BGZF block.
+ */
+static void reader_add_mark(Reader *rd, size_t buf_pos) {
+  ReaderMark *mark;
+
+  if(rd->n_mark >= rd->max_mark) {
+    rd->max_mark *= 2;
+    rd->marks = my_realloc(rd->marks, sizeof(ReaderMark) * rd->max_mark);
+  }
+  mark = &rd->marks[rd->n_mark];
+  mark->buf_pos = buf_pos;
+  mark->blk_pos = rd->blk_pos;
+  mark->coffset = rd->blk->coffset;
+  mark->comp_len = rd->blk->comp_len;
+  mark->data_len = rd->blk->data_len;
+  rd->n_mark += 1;
+}
+
+
+/**
+ * Discards marks that refer only to data before the start of the
+ * buffer, after the buffer has been shifted left by shift bytes.
+ */
+static void reader_shift_marks(Reader *rd, size_t shift) {
+  int i, first;
+
+  first = 0;
+  for(i = 0; i < rd->n_mark; i++) {
+    rd->marks[i].buf_pos -= shift;
+    if(rd->marks[i].buf_pos <= 0) {
+      first = i;
+    }
+  }
+  if(first > 0) {
+    memmove(rd->marks, &rd->marks[first],
+	    sizeof(ReaderMark) * (rd->n_mark - first));
+    rd->n_mark -= first;
+  }
+}
+
+
+
+/**
+ * Copies up to n bytes of decompressed data from BGZF blocks into
+ * the end of the buffer. Returns number of bytes copied, which is 0
+ * at EOF.
+ */
+static size_t reader_bgzf_read(Reader *rd, size_t n) {
+  size_t n_read, n_copy;
+
+  n_read = 0;
+  while(n_read < n) {
+    if(rd->blk == NULL || rd->blk_pos == rd->blk->data_len) {
+      rd->blk = bgzf_read_block(rd->bgzf);
+      rd->blk_pos = 0;
+      if(rd->blk == NULL) {
+	break;
+      }
+      continue;
+    }
+
+    n_copy = rd->blk->data_len - rd->blk_pos;
+    if(n_copy > n - n_read) {
+      n_copy = n - n_read;
+    }
+    reader_add_mark(rd, rd->end + n_read);
+    memcpy(&rd->buf[rd->end + n_read], &rd->blk->data[rd->blk_pos], n_copy);
+    rd->blk_pos += n_copy;
+    n_read += n_copy;
+  }
+
+  return n_read;
+}
+
+
+
+/**
+ * Moves unread data to start of buffer (doubling buffer size if it
+ * is already full) and then inflates as much data as fits into the
+ * remainder of the buffer. Always leaves one spare byte at end of
+ * buffer so that a '\0' can be added after the last line.
+ */
+static void reader_fill(Reader *rd) {
+  size_t n_unread, n_free;
+  long n;
+
+  n_unread = rd->end - rd->start;
+
+  if(rd->start > 0) {
+    memmove(rd->buf, &rd->buf[rd->start], n_unread);
+    rd->scan -= rd->start;
+    if(rd->bgzf) {
+      reader_shift_marks(rd, rd->start);
+    }
+    rd->start = 0;
+    rd->end = n_unread;
+  }
+
+  if(rd->end + 1 >= rd->buf_size) {
+    /* buffer is full, but does not contain a complete line */
+    rd->buf_size *= 2;
+    rd->buf = my_realloc(rd->buf, rd->buf_size);
+  }
+
+  n_free = rd->buf_size - rd->end - 1;
+
+  if(rd->bgzf) {
+    n = reader_bgzf_read(rd, n_free);
+  } else {
+    if(n_free > INT_MAX) {
+      n_free = INT_MAX;
+    }
+    n = gzread(rd->gzf, &rd->buf[rd->end], n_free);
+    if(n < 0) {
+      int errnum;
+      my_err("%s:%d: error reading file: %s", __FILE__, __LINE__,
+	     gzerror(rd->gzf, &errnum));
+    }
+  }
+  if(n == 0) {
+    rd->at_eof = TRUE;
+  }
+  rd->end += n;
+}
+
+
+
+/**
+ * Returns the next line of a memory-mapped file. Lines are views
+ * into the mapping, which are terminated by '\n' rather than '\0'.
+ */
+static long reader_map_getline(Reader *rd, const char **line) {
+  const char *nl;
+  size_t len;
+
+  if(rd->start >= rd->map_len) {
+    return -1;
+  }
+  *line = &rd->map[rd->start];
+  nl = memchr(*line, '\n', rd->map_len - rd->start);
+
+  if(nl) {
+    len = nl - *line;
+    rd->start += len + 1;
+    return len;
+  }
+
+  /* last line is not terminated by '\n' and there may be no byte
+   * after the end of the mapping, so copy it to add a '\0'
+   */
+  len = rd->map_len - rd->start;
+  rd->buf = my_malloc(len + 1);
+  memcpy(rd->buf, *line, len);
+  rd->buf[len] = '\0';
+  *line = rd->buf;
+  rd->start = rd->map_len;
+  return len;
+}
+
+
+
+/**
+ * Reads the next line and sets *line to point to it. The line is a
+ * view into the reader's buffer (or into the file itself, if it is
+ * memory-mapped) and is only valid until the next call to this
+ * function. The line must not be modified. It is terminated by
+ * '\n' or '\0', which is not included in the returned length, so
+ * parsers can safely look one byte past the end of the line.
+ * Returns the length of the line, or -1 if at EOF.
+ */
+long reader_getline(Reader *rd, const char **line) {
+  char *nl;
+  size_t len;
+
+  if(rd->map) {
+    return reader_map_getline(rd, line);
+  }
+
+  while(TRUE) {
+    nl = memchr(&rd->buf[rd->scan], '\n', rd->end - rd->scan);
+
+    if(nl) {
+      *nl = '\0';
+      *line = &rd->buf[rd->start];
+      len = nl - *line;
+      rd->start += len + 1;
+      rd->scan = rd->start;
+      return len;
+    }
+    rd->scan = rd->end;
+
+    if(rd->at_eof) {
+      if(rd->start == rd->end) {
+	return -1;
+      }
+      /* last line is not terminated by '\n' */
+      rd->buf[rd->end] = '\0';
+      *line = &rd->buf[rd->start];
+      len = rd->end - rd->start;
+      rd->start = rd->scan = rd->end;
+      return len;
+    }
+
+    reader_fill(rd);
+  }
+}
+
+
+
+/**
+ * Returns the virtual offset of position blk_pos in a block. The
+ * end of a block is returned as the start of the next block, because
+ * a block can hold 65536 bytes, which does not fit in 16 bits.
+ */
+static int64_t reader_voffset(int64_t coffset, int comp_len, int data_len,
+			      long blk_pos) {
+  if(blk_pos >= data_len) {
+    return (coffset + comp_len) << 16;
+  }
+  return (coffset << 16) | blk_pos;
+}
+
+
+
+/**
+ * Returns the BGZF virtual file offset of the next line that will be
+ * returned by reader_getline. The upper 48 bits of the virtual
+ * offset are the offset of the compressed block in the file and the
+ * lower 16 bits are the offset within the uncompressed block.
+ */
+int64_t reader_tell(Reader *rd) {
+  ReaderMark *mark;
+  int i;
+
+  if(rd->bgzf == NULL) {
+    my_err("%s:%d: virtual file offsets are only available for "
+	   "BGZF-compressed files", __FILE__, __LINE__);
+  }
+
+  for(i = rd->n_mark - 1; i >= 0; i--) {
+    mark = &rd->marks[i];
+    if(mark->buf_pos <= (long)rd->start) {
+      return reader_voffset(mark->coffset, mark->comp_len, mark->data_len,
+			    mark->blk_pos + ((long)rd->start - mark->buf_pos));
+    }
+  }
+
+  /* nothing has been read yet */
+  if(rd->blk) {
+    return reader_voffset(rd->blk->coffset, rd->blk->comp_len,
+			  rd->blk->data_len, rd->blk_pos);
+  }
+  return rd->bgzf->coffset << 16;
+}
+
+
+
+/**
+ * Moves the reader to the provided BGZF virtual file offset,
+ * discarding any buffered data.
+ */
+void reader_seek(Reader *rd, int64_t voffset) {
+  int64_t coffset;
+  int uoffset;
+
+  if(rd->bgzf == NULL) {
+    my_err("%s:%d: can only seek in BGZF-compressed files",
+	   __FILE__, __LINE__);
+  }
+
+  coffset = voffset >> 16;
+  uoffset = voffset & 0xFFFF;
+
+  bgzf_reader_seek(rd->bgzf, coffset);
+
+  rd->start = rd->end = rd->scan = 0;
+  rd->at_eof = FALSE;
+  rd->n_mark = 0;
+
+  rd->blk = bgzf_read_block(rd->bgzf);
+  rd->blk_pos = 0;
+
+  if(rd->blk == NULL) {
+    if(uoffset > 0) {
+      my_err("%s:%d: cannot seek past end of file", __FILE__, __LINE__);
+    }
+    return;
+  }
+
+  if(uoffset > rd->blk->data_len) {
+    my_err("%s:%d: invalid virtual file offset %lld: block is only "
+	   "%d bytes", __FILE__, __LINE__, (long long)voffset,
+	   rd->blk->data_len);
+  }
+  rd->blk_pos = uoffset;
+}
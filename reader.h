@@ -0,0 +1,83 @@
+#ifndef __READER_H__
+#define __READER_H__
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include "bgzf.h"
+
+/* initial size of reader buffer, grows if a single line is longer */
+#define READER_BUF_SZ (1024 * 1024)
+
+
+/* initial number of BGZF block marks, grows as needed */
+#define READER_N_MARK_INIT 32
+
+
+/**
+ * Records which BGZF block the data at a given position in the
+ * reader's buffer came from, so that virtual file offsets can be
+ * computed for lines in the buffer.
+ */
+typedef struct {
+  /* position in buffer (can be negative after the buffer is compacted) */
+  long buf_pos;
+  /* corresponding offset within uncompressed block */
+  int blk_pos;
+  /* offset of block in compressed file */
+  int64_t coffset;
+  /* compressed and uncompressed lengths of block */
+  int comp_len;
+  int data_len;
+} ReaderMark;
+
+
+/**
+ * Block-buffered line reader. Large chunks of the (possibly
+ * gzipped) file are inflated into buf at once and lines are
+ * returned as views into buf. BGZF files are inflated
+ * by a BGZFReader, other files are read through zlib.
+ *
+ * Uncompressed regular files are instead memory-mapped and lines are
+ * returned as views directly into the mapping, without being copied.
+ */
+typedef struct {
+  gzFile gzf;
+  int own_gzf;
+
+  /* mapping of uncompressed file, or NULL if file is not mapped */
+  const char *map;
+  size_t map_len;
+
+  BGZFReader *bgzf;
+  BGZFBlock *blk;
+  int blk_pos;
+
+  ReaderMark *marks;
+  int n_mark;
+  int max_mark;
+
+  char *buf;
+  size_t buf_size;
+
+  /* offset of first unread byte and end of valid data in buf */
+  size_t start;
+  size_t end;
+
+  /* offset that memchr has already scanned up to without finding '\n' */
+  size_t scan;
+
+  int at_eof;
+} Reader;
+
+
+Reader *reader_new(gzFile gzf);
+Reader *reader_open(const char *path, int n_threads);
+void reader_free(Reader *rd);
+
+long reader_getline(Reader *rd, const char **line);
+
+int64_t reader_tell(Reader *rd);
+void reader_seek(Reader *rd, int64_t voffset);
+
+#endif
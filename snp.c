@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "snp.h"
+#include "memutil.h"
+#include "util.h"
+
+
+
+/**
+ * Initializes an empty SNP. Genotype arrays are set to NULL and must
+ * be allocated by the caller if they are wanted.
+ */
+void snp_init(SNP *snp) {
+  snp_str_init(&snp->name);
+  snp_str_init(&snp->chrom_name);
+  snp->chrom_id = -1;
+  snp->pos = 0;
+  snp_str_init(&snp->allele1);
+  snp_str_init(&snp->allele2);
+
+  snp->has_geno_probs = FALSE;
+  snp->has_haplotypes = FALSE;
+  snp->has_dosages = FALSE;
+  snp->has_other_alleles = FALSE;
+  snp->geno_probs = NULL;
+  snp->haplotypes = NULL;
+  snp->packed_haps = NULL;
+  snp->unphased = NULL;
+  snp->dosages = NULL;
+}
+
+
+/**
+ * Frees buffers that hold copies of fixed columns. Genotype arrays
+ * are not freed.
+ */
+void snp_free_strs(SNP *snp) {
+  snp_str_free(&snp->name);
+  snp_str_free(&snp->chrom_name);
+  snp_str_free(&snp->allele1);
+  snp_str_free(&snp->allele2);
+}
+
+
+
+void snp_str_init(SNPStr *s) {
+  s->str = "";
+  s->len = 0;
+  s->buf = NULL;
+  s->buf_size = 0;
+}
+
+
+void snp_str_free(SNPStr *s) {
+  if(s->buf) {
+    my_free(s->buf);
+  }
+  snp_str_init(s);
+}
+
+
+
+/**
+ * Sets s to the string of length len at str. If copy is TRUE the
+ * string is copied into the buffer owned by s, otherwise s becomes a
+ * view of str, which must remain valid for as long as s is used.
+ */
+void snp_str_set(SNPStr *s, const char *str, size_t len, int copy) {
+  if(!copy) {
+    s->str = str;
+    s->len = len;
+    return;
+  }
+
+  if(len + 1 > s->buf_size) {
+    if(s->buf_size == 0) {
+      s->buf_size = SNP_STR_INIT_SIZE;
+    }
+    while(len + 1 > s->buf_size) {
+      s->buf_size *= 2;
+    }
+    s->buf = my_realloc(s->buf, s->buf_size);
+  }
+  memcpy(s->buf, str, len);
+  s->buf[len] = '\0';
+  s->str = s->buf;
+  s->len = len;
+}
+
+
+
+/**
+ * Compares s to the '\0'-terminated string str, in the same way as
+ * strcmp.
+ */
+int snp_str_cmp(const SNPStr *s, const char *str) {
+  int cmp;
+
+  cmp = strncmp(s->str, str, s->len);
+  if(cmp != 0) {
+    return cmp;
+  }
+  return (str[s->len] == '\0') ? 0 : -1;
+}
@@ -2,24 +2,103 @@
 #define __SNP_H__
 
 
-#define SNP_MAX_ALLELE 1024
-#define SNP_MAX_CHROM 1024
-#define SNP_MAX_NAME 1024
+#include <stddef.h>
 
+/* initial size of buffers that hold copies of fixed columns */
+#define SNP_STR_INIT_SIZE 64
 
+/* Packed haplotypes use 2 bits per allele, so 4 alleles per byte.
+ * Each allele is 0, 1 or SNP_PACKED_MISSING. Allele i of sample s is
+ * at index s*2 + i, as with unpacked haplotypes.
+ */
+#define SNP_PACKED_MISSING 3
+#define SNP_PACKED_SIZE(n_hap) (((n_hap) + 3) >> 2)
+#define SNP_PACKED_SHIFT(i) (((i) & 3) << 1)
+
+/* gets 2 bit code of allele i */
+#define SNP_PACKED_CODE(packed, i) \
+  (((packed)[(i) >> 2] >> SNP_PACKED_SHIFT(i)) & 3)
+
+/* gets allele i as 0, 1 or -1 if it is missing */
+#define SNP_PACKED_GET(packed, i) \
+  ((SNP_PACKED_CODE(packed, i) == SNP_PACKED_MISSING) ? -1 : \
+   (int)SNP_PACKED_CODE(packed, i))
+
+/* sets allele i to hap, which is 0, 1 or -1 (missing) */
+#define SNP_PACKED_SET(packed, i, hap) \
+  ((packed)[(i) >> 2] = ((packed)[(i) >> 2] & ~(3 << SNP_PACKED_SHIFT(i))) | \
+   (((hap) & 3) << SNP_PACKED_SHIFT(i)))
+
+/* Phase of genotypes is stored as a bitmap with 1 bit per sample,
+ * which is set if the genotype of the sample is not phased (its
+ * alleles are not delimited by '|').
+ */
+#define SNP_UNPHASED_SIZE(n_samples) (((n_samples) + 7) >> 3)
+#define SNP_UNPHASED_GET(bits, i) (((bits)[(i) >> 3] >> ((i) & 7)) & 1)
+#define SNP_UNPHASED_SET(bits, i) ((bits)[(i) >> 3] |= 1 << ((i) & 7))
+
+
+/**
+ * A fixed column of a record, such as the ID or an allele. str is
+ * not necessarily '\0'-terminated, so len must be used to read it. In
+ * view mode str points into the line that the record was parsed from
+ * and is only valid until the next record is read. In copy mode str
+ * points to buf, which is owned by the SNP, grows as needed and is
+ * '\0'-terminated.
+ */
 typedef struct {
-  char name[SNP_MAX_NAME];
-  char chrom_name[SNP_MAX_CHROM];
+  const char *str;
+  size_t len;
+
+  char *buf;
+  size_t buf_size;
+} SNPStr;
+
+
+typedef struct {
+  SNPStr name;
+  SNPStr chrom_name;
+
+  /* index of chromosome in the chrom table of the VCFInfo that the
+   * record was read with, so that records can be compared without
+   * comparing names. -1 if it is not declared in the header.
+   */
+  int chrom_id;
   long pos;
-  char allele1[SNP_MAX_ALLELE];
-  char allele2[SNP_MAX_ALLELE];
+  SNPStr allele1;
+  SNPStr allele2;
   
   char has_geno_probs;
   char has_haplotypes;
+  char has_dosages;
+
+  /* TRUE if some genotypes have alleles other than 0 and 1 (e.g. at
+   * multi-allelic sites), which are stored as missing
+   */
+  char has_other_alleles;
+
   float *geno_probs;
   char *haplotypes;
+
+  /* haplotypes packed 2 bits per allele, see SNP_PACKED_GET */
+  unsigned char *packed_haps;
+
+  /* if non-NULL, set along with haplotypes to record which genotypes
+   * are unphased, see SNP_UNPHASED_GET
+   */
+  unsigned char *unphased;
+
+  /* one dosage per sample, encoded as described by VCFInfo.dosage_type */
+  unsigned char *dosages;
 } SNP;
 
 
+void snp_init(SNP *snp);
+void snp_free_strs(SNP *snp);
+
+void snp_str_init(SNPStr *s);
+void snp_str_free(SNPStr *s);
+void snp_str_set(SNPStr *s, const char *str, size_t len, int copy);
+int snp_str_cmp(const SNPStr *s, const char *str);
 
 #endif
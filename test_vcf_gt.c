@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vcf.h"
+#include "reader.h"
+#include "snp.h"
+#include "util.h"
+#include "memutil.h"
+
+/*
+ * Checks that the SIMD fast path for fixed-width "a|b" genotypes
+ * decodes samples, and that its output matches the scalar parser.
+ * Run with 'make check'.
+ */
+
+#define TEST_N_SAMPLES 255
+#define TEST_VCF_PATH "test_vcf_gt.tmp.vcf"
+
+
+static int n_fail = 0;
+
+static void check(int ok, const char *msg) {
+  if(!ok) {
+    fprintf(stderr, "FAIL: %s\n", msg);
+    n_fail += 1;
+  }
+}
+
+
+
+/**
+ * Writes a VCF with two records that have the same genotypes. The
+ * first only has a GT field, so it can be decoded by the fast path.
+ * The second also has a DP field, so it is decoded by the scalar
+ * parser.
+ */
+static void write_test_vcf(const char *path, const char *alleles) {
+  FILE *fh;
+  long i;
+
+  fh = util_must_fopen(path, "w");
+  fprintf(fh, "##fileformat=VCFv4.2\n");
+  fprintf(fh, "##contig=<ID=1,length=1000>\n");
+  fprintf(fh, "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT");
+  for(i = 0; i < TEST_N_SAMPLES; i++) {
+    fprintf(fh, "\tS%ld", i);
+  }
+  fprintf(fh, "\n1\t100\trs1\tA\tG\t.\tPASS\t.\tGT");
+  for(i = 0; i < TEST_N_SAMPLES; i++) {
+    fprintf(fh, "\t%c|%c", alleles[i*2], alleles[i*2+1]);
+  }
+  fprintf(fh, "\n1\t100\trs1\tA\tG\t.\tPASS\t.\tGT:DP");
+  for(i = 0; i < TEST_N_SAMPLES; i++) {
+    fprintf(fh, "\t%c|%c:0", alleles[i*2], alleles[i*2+1]);
+  }
+  fprintf(fh, "\n");
+  fclose(fh);
+}
+
+
+
+/**
+ * Calls the fast path directly on the sample columns of a GT-only
+ * line, and checks how many samples it decoded and what they are
+ */
+static void check_fast_path(const char *alleles) {
+  char line[TEST_N_SAMPLES * 4], haps[TEST_N_SAMPLES * 2];
+  unsigned char packed[SNP_PACKED_SIZE(TEST_N_SAMPLES * 2)];
+  long i, n, len;
+
+  len = 0;
+  for(i = 0; i < TEST_N_SAMPLES; i++) {
+    line[len++] = alleles[i*2];
+    line[len++] = '|';
+    line[len++] = alleles[i*2+1];
+    line[len++] = '\t';
+  }
+  /* last sample is terminated by end of line */
+  line[len-1] = '\n';
+
+  n = vcf_parse_gt_fixed(line, len, TEST_N_SAMPLES, haps, NULL);
+  fprintf(stderr, "fast path decoded %ld/%d samples\n", n, TEST_N_SAMPLES);
+#ifdef __SSE2__
+  /* all but the last sample and a partial block of 8 */
+  check(n >= ((TEST_N_SAMPLES - 1) / 8) * 8,
+	"fast path decoded too few samples");
+#endif
+  for(i = 0; i < n * 2; i++) {
+    check(haps[i] == alleles[i] - '0', "fast path allele is wrong");
+  }
+
+  memset(packed, 0, sizeof(packed));
+  check(vcf_parse_gt_fixed(line, len, TEST_N_SAMPLES, NULL, packed) == n,
+	"packed fast path decoded different number of samples");
+  for(i = 0; i < n * 2; i++) {
+    check(SNP_PACKED_GET(packed, i) == alleles[i] - '0',
+	  "packed fast path allele is wrong");
+  }
+
+  /* a sample that is not "a|b" stops the fast path */
+  line[16*4 + 1] = '/';
+  check(vcf_parse_gt_fixed(line, len, TEST_N_SAMPLES, haps, NULL) <= 16,
+	"fast path decoded unphased genotype");
+}
+
+
+
+/**
+ * Parses both records of the test VCF and checks that the record
+ * decoded by the fast path matches the one decoded by the scalar
+ * parser
+ */
+static void check_parse_line(const char *alleles) {
+  Reader *rd;
+  VCFInfo *vcf_info;
+  SNP snp;
+  char *fast_haps;
+  long i;
+
+  rd = reader_open(TEST_VCF_PATH, 0);
+  vcf_info = vcf_info_new();
+  vcf_read_header(rd, vcf_info);
+  check(vcf_info->n_samples == TEST_N_SAMPLES, "wrong number of samples");
+
+  snp_init(&snp);
+  snp.haplotypes = my_malloc(vcf_info->n_haplo_col);
+  fast_haps = my_malloc(vcf_info->n_haplo_col);
+
+  check(vcf_read_line(rd, vcf_info, &snp) == 0, "could not read record 1");
+  memcpy(fast_haps, snp.haplotypes, vcf_info->n_haplo_col);
+  check(vcf_read_line(rd, vcf_info, &snp) == 0, "could not read record 2");
+
+  for(i = 0; i < vcf_info->n_haplo_col; i++) {
+    check(fast_haps[i] == snp.haplotypes[i],
+	  "fast path and scalar parser disagree");
+    check(snp.haplotypes[i] == alleles[i] - '0', "scalar allele is wrong");
+  }
+
+  my_free(fast_haps);
+  my_free(snp.haplotypes);
+  snp_free_strs(&snp);
+  vcf_info_free(vcf_info);
+  reader_free(rd);
+}
+
+
+
+int main(int argc, char **argv) {
+  char alleles[TEST_N_SAMPLES * 2];
+  long i;
+
+  srand(1);
+  for(i = 0; i < TEST_N_SAMPLES * 2; i++) {
+    alleles[i] = (rand() & 1) ? '1' : '0';
+  }
+
+  write_test_vcf(TEST_VCF_PATH, alleles);
+  check_fast_path(alleles);
+  check_parse_line(alleles);
+  remove(TEST_VCF_PATH);
+
+  if(n_fail > 0) {
+    fprintf(stderr, "%d checks failed\n", n_fail);
+    return 1;
+  }
+  fprintf(stderr, "all checks passed\n");
+  return 0;
+}
@@ -432,28 +432,34 @@ char *util_gzgets_line(gzFile gzf) {
  * is set appropriately. Newlines chars are replaced with terminating '\0'. 
  * Returns the length of the string read from file (typically one less than 
  * number of bytes read because newline replaced with '\0') or -1 if at EOF.
+ *
+ * The line is read in chunks with gzgets, which searches zlib's
+ * output buffer for the newline rather than fetching one char at a
+ * time. Callers reading many lines from the same file should use a
+ * Reader (see reader.h) instead.
  */
 size_t util_gzgetline(gzFile gzf, char **lineptr, size_t *size) {
-  char c;
-  size_t i;
+  size_t i, n;
 
   i = 0;
-  while((c = gzgetc(gzf)) != -1) {
-    if(i >= *size) {
+  while(TRUE) {
+    if(i + 1 >= *size) {
       /* buffer is full, double its size */
       *size = *size * 2;
-      /* fprintf(stderr, "expanding mem to %ld bytes\n", *size); */
       *lineptr = my_realloc(*lineptr, *size);
     }
-    
-    if(c == '\n') {
-      /* end of line, terminate  */
-      (*lineptr)[i] = '\0';
-      return i;
+
+    if(gzgets(gzf, &(*lineptr)[i], *size - i) == NULL) {
+      break;
     }
+    n = strlen(&(*lineptr)[i]);
+    i += n;
 
-    (*lineptr)[i] = c;
-    i++;
+    if(i > 0 && (*lineptr)[i-1] == '\n') {
+      /* end of line, terminate  */
+      (*lineptr)[i-1] = '\0';
+      return i-1;
+    }
   }
 
   if(i == 0) {
@@ -461,16 +467,7 @@ size_t util_gzgetline(gzFile gzf, char **lineptr, size_t *size) {
     return -1;
   }
 
-  
-  /* did not hit a '\n' before EOF, add terminating '\0' to line 
-   * before returning it
-   */
-  if(i+1 >= *size) {
-    *lineptr = my_realloc(*lineptr, i+1);
-    *size = i+1;
-  }
-  (*lineptr)[i+1] = '\0';
-  
+  /* did not hit a '\n' before EOF, line is already terminated by gzgets */
   return i;
 }
 
@@ -510,6 +507,7 @@ char *util_fgets_line(FILE *fh) {
 
   if(i == 0) {
     /* at EOF */
+    my_free(line);
     return NULL;
   }
 
@@ -517,10 +515,10 @@ char *util_fgets_line(FILE *fh) {
   /* did not hit a '\n' before EOF, add terminating '\0' to line 
    * before returning it
    */
-  if(i+1 >= size) {
+  if(i >= size) {
     line = my_realloc(line, i+1);
   }
-  line[i+1] = '\0';
+  line[i] = '\0';
   
   return line;
 }
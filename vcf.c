@@ -1,15 +1,45 @@
 
 #include <zlib.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "vcf.h"
+#include "vcfidx.h"
 #include "memutil.h"
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#define VCF_GT_SIMD 1
+#include <immintrin.h>
+#endif
+
 #define VCF_GTYPE_MISSING -1
 
+/* lines may be terminated by '\n' (when they are views into a
+ * memory-mapped file) or by '\0'
+ */
+#define VCF_IS_LINE_END(c) ((c) == '\n' || (c) == '\0')
+#define VCF_IS_COL_END(c) ((c) == '\t' || VCF_IS_LINE_END(c))
+#define VCF_IS_FIELD_END(c) ((c) == ':' || VCF_IS_COL_END(c))
+
+/* bytes taken by a biallelic, single-digit GT field and its delimiter
+ * e.g. "0|1\t"
+ */
+#define VCF_GT_STRIDE 4
+
+/* size of lookup tables used to convert log10 likelihoods to probs */
+#define VCF_EXP10_N_INT 40
+#define VCF_EXP10_N_FRAC 1024
+
+/* phred-scaled likelihoods below this are converted with a lookup table */
+#define VCF_PL_N_TABLE 256
+
 
 
 const char *vcf_fix_headers[] =
@@ -27,18 +57,93 @@ VCFInfo *vcf_info_new() {
 
   vcf_info = my_malloc(sizeof(VCFInfo));
 
-  /* dynamic buffer used for reading lines (can grow)  */
-  vcf_info->buf_size = 1024;
-  vcf_info->buf = my_malloc(vcf_info->buf_size);
+  vcf_info->n_samples = 0;
+  vcf_info->n_geno_prob_col = 0;
+  vcf_info->n_haplo_col = 0;
+  vcf_info->n_header_lines = 0;
+
+  /* all samples are parsed unless a subset is selected */
+  vcf_info->n_file_samples = 0;
+  vcf_info->sample_names = NULL;
+  vcf_info->sample_keep = NULL;
+
+  /* lines are read into buffer owned by reader */
+  vcf_info->line_len = 0;
+  vcf_info->buf = NULL;
+
+  vcf_info->format[0] = '\0';
+  vcf_info->prob_src = VCF_PROB_AUTO;
+  vcf_info->dosage_type = VCF_DOSAGE_NONE;
+  vcf_info->record_mode = VCF_RECORD_COPY;
+  snp_str_init(&vcf_info->qual);
+  snp_str_init(&vcf_info->filter);
+  snp_str_init(&vcf_info->info);
+  vcf_parse_format(vcf_info->format, vcf_info->prob_src, &vcf_info->fmt);
 
   vcf_info->n_chrom = 0;
   vcf_info->max_chrom = VCF_N_CHROM_INIT;
   vcf_info->chrom = my_malloc(sizeof(Chromosome) * VCF_N_CHROM_INIT);
+  vcf_info->chrom_dict = chrom_dict_new();
+  vcf_info->last_chrom = -1;
+  vcf_info->unknown_chroms = NULL;
+  vcf_info->warn_chrom = TRUE;
   
   return vcf_info;
 }
 
 
+/**
+ * Returns a new VCFInfo with the same header information (number of
+ * samples and chromosomes) and parse settings as vcf_info. It can be
+ * used to parse records of the same file on another thread.
+ */
+VCFInfo *vcf_info_clone(VCFInfo *vcf_info) {
+  VCFInfo *clone;
+  long i;
+
+  clone = vcf_info_new();
+
+  clone->n_samples = vcf_info->n_samples;
+  clone->n_geno_prob_col = vcf_info->n_geno_prob_col;
+  clone->n_haplo_col = vcf_info->n_haplo_col;
+  clone->n_header_lines = vcf_info->n_header_lines;
+
+  clone->n_file_samples = vcf_info->n_file_samples;
+  if(vcf_info->sample_names) {
+    clone->sample_names = my_new(char *, vcf_info->n_file_samples);
+    for(i = 0; i < vcf_info->n_file_samples; i++) {
+      clone->sample_names[i] = util_str_dup(vcf_info->sample_names[i]);
+    }
+  }
+  if(vcf_info->sample_keep) {
+    clone->sample_keep = my_new(char, vcf_info->n_file_samples);
+    memcpy(clone->sample_keep, vcf_info->sample_keep,
+	   vcf_info->n_file_samples);
+  }
+
+  vcf_set_prob_source(clone, vcf_info->prob_src);
+  vcf_set_dosage_type(clone, vcf_info->dosage_type);
+  vcf_set_record_mode(clone, vcf_info->record_mode);
+
+  clone->max_chrom = (vcf_info->n_chrom > VCF_N_CHROM_INIT) ?
+    vcf_info->n_chrom : VCF_N_CHROM_INIT;
+  clone->chrom = my_realloc(clone->chrom, sizeof(Chromosome) *
+			    clone->max_chrom);
+  for(i = 0; i < vcf_info->n_chrom; i++) {
+    clone->chrom[i].id = vcf_info->chrom[i].id;
+    clone->chrom[i].name = util_str_dup(vcf_info->chrom[i].name);
+    clone->chrom[i].assembly = util_str_dup(vcf_info->chrom[i].assembly);
+    clone->chrom[i].len = vcf_info->chrom[i].len;
+    chrom_dict_add(clone->chrom_dict, clone->chrom[i].name,
+		   strlen(clone->chrom[i].name));
+  }
+  clone->n_chrom = vcf_info->n_chrom;
+
+  return clone;
+}
+
+
+
 /** 
  * free memory allocated for reading lines
  * and for chromosomes
@@ -52,7 +157,21 @@ void vcf_info_free(VCFInfo *vcf_info) {
   }
 
   my_free(vcf_info->chrom);
-  my_free(vcf_info->buf);
+  chrom_dict_free(vcf_info->chrom_dict);
+  if(vcf_info->unknown_chroms) {
+    chrom_dict_free(vcf_info->unknown_chroms);
+  }
+
+  if(vcf_info->sample_names) {
+    vcf_free_sample_list(vcf_info->sample_names, vcf_info->n_file_samples);
+  }
+  if(vcf_info->sample_keep) {
+    my_free(vcf_info->sample_keep);
+  }
+
+  snp_str_free(&vcf_info->qual);
+  snp_str_free(&vcf_info->filter);
+  snp_str_free(&vcf_info->info);
   my_free(vcf_info);
 }
 
@@ -75,6 +194,10 @@ void vcf_add_chrom(char *contig_str, VCFInfo *vcf_info) {
   /* parse contig string which looks like:
    * ##contig=<ID=8,assembly=b37,length=146364022>
    */
+  vcf_info->chrom[i].name = NULL;
+  vcf_info->chrom[i].assembly = NULL;
+  vcf_info->chrom[i].len = 0;
+
   cur = contig_str;
   while((tok = strsep(&cur, "<>,")) != NULL) {
     if(util_str_starts_with(tok, "ID=")) {
@@ -88,6 +211,30 @@ void vcf_add_chrom(char *contig_str, VCFInfo *vcf_info) {
     }
   }
 
+  if(vcf_info->chrom[i].name == NULL) {
+    my_warn("%s:%d: ignoring contig header line without ID", __FILE__,
+	    __LINE__);
+    if(vcf_info->chrom[i].assembly) {
+      my_free(vcf_info->chrom[i].assembly);
+    }
+    return;
+  }
+  if(chrom_dict_add(vcf_info->chrom_dict, vcf_info->chrom[i].name,
+		    strlen(vcf_info->chrom[i].name)) != i) {
+    /* records are resolved to first contig with this name */
+    my_warn("%s:%d: ignoring duplicate contig header line for '%s'",
+	    __FILE__, __LINE__, vcf_info->chrom[i].name);
+    my_free(vcf_info->chrom[i].name);
+    if(vcf_info->chrom[i].assembly) {
+      my_free(vcf_info->chrom[i].assembly);
+    }
+    return;
+  }
+  if(vcf_info->chrom[i].assembly == NULL) {
+    /* assembly is optional */
+    vcf_info->chrom[i].assembly = util_str_dup("");
+  }
+
   vcf_info->chrom[i].id = i;
   fprintf(stderr, "chromosome: %s %s %ld\n",
 	  vcf_info->chrom[i].name,
@@ -100,9 +247,9 @@ void vcf_add_chrom(char *contig_str, VCFInfo *vcf_info) {
 }
 
 
-void vcf_read_header(gzFile vcf_fh, VCFInfo *vcf_info) {
+void vcf_read_header(Reader *rd, VCFInfo *vcf_info) {
   char *line, *cur, *token;
-  int tok_num;
+  long tok_num, max_samples;
   int n_fix_header;
   
   /* const char delim[] = " \t"; */
@@ -113,8 +260,9 @@ void vcf_read_header(gzFile vcf_fh, VCFInfo *vcf_info) {
   vcf_info->n_header_lines = 0;
 
   
-  while(util_gzgetline(vcf_fh, &vcf_info->buf, &vcf_info->buf_size) != -1) {
-    line = vcf_info->buf;
+  while((vcf_info->line_len = reader_getline(rd, &vcf_info->buf)) != -1) {
+    /* lines are read-only views, so copy before tokenizing */
+    line = util_str_ndup(vcf_info->buf, vcf_info->line_len);
   
     if(util_str_starts_with(line, "##")) {
       /* header line */
@@ -128,384 +276,1931 @@ void vcf_read_header(gzFile vcf_fh, VCFInfo *vcf_info) {
       /* this should be last header line that contains list of fixed fields */
       vcf_info->n_header_lines += 1;
 	
-      cur = vcf_info->buf;
+      cur = line;
       tok_num = 0;
+      max_samples = VCF_N_SAMPLE_INIT;
+      vcf_info->sample_names = my_new(char *, max_samples);
       while((token = strsep(&cur, delim)) != NULL) {
 	if(tok_num < n_fix_header) {
 	  if(strcmp(token, vcf_fix_headers[tok_num]) != 0) {
-	    my_warn("expected token %d to be %s but got '%s'",
+	    my_warn("expected token %ld to be %s but got '%s'",
 		    tok_num, vcf_fix_headers[tok_num], token);
 	  }
+	} else {
+	  /* remaining tokens are sample names */
+	  if(tok_num - n_fix_header >= max_samples) {
+	    max_samples *= 2;
+	    vcf_info->sample_names = my_realloc(vcf_info->sample_names,
+						sizeof(char *) * max_samples);
+	  }
+	  vcf_info->sample_names[tok_num - n_fix_header] =
+	    util_str_dup(token);
 	}
 	tok_num += 1;
       }
-      vcf_info->n_samples = tok_num - n_fix_header;
+      vcf_info->n_samples = (tok_num > n_fix_header) ?
+	tok_num - n_fix_header : 0;
+      vcf_info->n_file_samples = vcf_info->n_samples;
 
       vcf_info->n_geno_prob_col = vcf_info->n_samples * 3;
       vcf_info->n_haplo_col = vcf_info->n_samples * 2;
 	
-      /* my_free(line); */
+      my_free(line);
       break;
     } else {
       my_err("expected last line in header to start with #CHROM");
     }
-    /* my_free(line); */
+    my_free(line);
   }
 }
 
 
 
 /**
- * Parses ':'-delimited format string and 
- * returns index of token that matches. 
- * Returns -1 on failure.
- * 
+ * Restricts parsing to the samples with the provided names, which are
+ * looked up in the #CHROM header line that was read by
+ * vcf_read_header. Other sample columns are skipped without being
+ * decoded, and genotype arrays only need to hold the selected
+ * samples, which are stored in the order they occur in the file.
+ *
+ * If found is NULL, every name must be in the header, and it is an
+ * error if no samples are selected. Otherwise names that are not in
+ * the header are ignored, and found[i] is set to TRUE if names[i]
+ * was selected (it is not cleared if it was not, so the same array
+ * can be used for several files). Returns the number of samples that
+ * were selected, which the caller must check when found is non-NULL.
  */
-int get_format_index(const char *format_str, const char *label) {
-  char fmt[VCF_MAX_FORMAT];
-  char delim[] = ":";
-  char *cur, *tok;
-  int idx, i;
+long vcf_select_samples(VCFInfo *vcf_info, char **names, long n_names,
+			char *found) {
+  ChromDict *dict;
+  long i, *col;
+  int id;
+
+  if(vcf_info->sample_names == NULL) {
+    my_err("%s:%d: sample names have not been read from VCF header",
+	   __FILE__, __LINE__);
+  }
 
-  /* copy format string before tokenizing (which modifies it) */
-  strcpy(fmt, format_str);
+  if(vcf_info->sample_keep == NULL) {
+    vcf_info->sample_keep = my_new(char, vcf_info->n_file_samples);
+  }
+  memset(vcf_info->sample_keep, FALSE, vcf_info->n_file_samples);
 
-  /* find index of label format specifier */
-  idx = -1;
-  i = 0;
-  cur = fmt;
-  while((tok = strsep(&cur, delim)) != NULL) {
-    if(strcmp(tok, label) == 0) {
-      /* found label in format string */
-      idx = i;
-      break;
+  /* hash header names once, so that panels with many samples do not
+   * need a comparison for every pair of names. col[id] is the first
+   * column with the name that has that ID.
+   */
+  dict = chrom_dict_new();
+  col = my_new(long, vcf_info->n_file_samples);
+  for(i = 0; i < vcf_info->n_file_samples; i++) {
+    id = chrom_dict_add(dict, vcf_info->sample_names[i],
+			strlen(vcf_info->sample_names[i]));
+    if(id == dict->n - 1) {
+      col[id] = i;
+    }
+  }
+
+  for(i = 0; i < n_names; i++) {
+    id = chrom_dict_lookup(dict, names[i], strlen(names[i]));
+    if(id == -1) {
+      if(found == NULL) {
+	my_err("%s:%d: sample '%s' is not in VCF header", __FILE__,
+	       __LINE__, names[i]);
+      }
+      continue;
+    }
+    vcf_info->sample_keep[col[id]] = TRUE;
+    if(found) {
+      found[i] = TRUE;
     }
-    i++;
   }
+  my_free(col);
+  chrom_dict_free(dict);
 
-  return idx;
+  vcf_info->n_samples = 0;
+  for(i = 0; i < vcf_info->n_file_samples; i++) {
+    if(vcf_info->sample_keep[i]) {
+      vcf_info->n_samples += 1;
+    }
+  }
+  if(vcf_info->n_samples == 0 && found == NULL) {
+    my_err("%s:%d: no samples were selected", __FILE__, __LINE__);
+  }
+  vcf_info->n_geno_prob_col = vcf_info->n_samples * 3;
+  vcf_info->n_haplo_col = vcf_info->n_samples * 2;
+
+  return vcf_info->n_samples;
 }
 
 
-void vcf_parse_haplotypes(VCFInfo *vcf_info, char *haplotypes,
-			  char *cur) {
-  int gt_idx, hap1, hap2, i, n;
-  static int warn_phase = TRUE;
-  long expect_haps, n_haps;
-  char gt_str[VCF_MAX_FORMAT];
-  
-  /* char delim[] = " \t"; */
-  char delim[] = "\t";
-  char inner_delim[] = ":";
-  char *inner_cur, *tok, *inner_tok;
-
-  /* get index of GT token in format string*/
-  gt_idx = get_format_index(vcf_info->format, "GT");
-  if(gt_idx == -1) {
-    my_err("%s:%d: VCF format string does not specify GT token "
-	   "so cannot obtain haplotypes. Format string: '%s'.\n"
-	   "To use this file, you must run snp2h5 without "
-	   "the --haplotype option.",
-	   __FILE__, __LINE__, vcf_info->format);
+
+/**
+ * Adds a copy of name to a growable list of sample names
+ */
+static void vcf_add_sample_name(char ***names, long *n_names,
+				long *max_names, const char *name,
+				size_t len) {
+  if(*n_names >= *max_names) {
+    *max_names *= 2;
+    *names = my_realloc(*names, sizeof(char *) * *max_names);
   }
-  
-  expect_haps = vcf_info->n_samples * 2;
-  
-  n_haps = 0;
-  
-  while((tok = strsep(&cur, delim)) != NULL) {
-    /* Each genotype string is delimited by ':'
-     * The GT portions of the string are delimited by '/' or '|'
-     * '|' indicates phased, '/' indicates unphased.
-     */
-    util_strncpy(gt_str, tok, sizeof(gt_str));
-    
-    i = 0;
-    inner_cur = gt_str;
-    while((i <= gt_idx) && (inner_tok = strsep(&inner_cur, inner_delim)) != NULL) {
-      if(i == gt_idx) {
-	n = sscanf(inner_tok, "%d|%d", &hap1, &hap2);
-	if(n != 2) {
-	  /* try with '/' separator instead */
-	  n = sscanf(inner_tok, "%d/%d", &hap1, &hap2);
-
-	  if(n == 2 && warn_phase) {
-	    my_warn("%s:%d: some genotypes are unphased (delimited "
-		    "with '/' instead of '|')\n", __FILE__, __LINE__,
-		    inner_tok);
-	    warn_phase = FALSE;
-	  } else {
-	    my_warn("%s:%d: could not parse genotype string '%s'\n",
-		    __FILE__, __LINE__, inner_tok);
-	    hap1 = VCF_GTYPE_MISSING;
-	    hap2 = VCF_GTYPE_MISSING;
-	  }
-	}
+  (*names)[*n_names] = util_str_ndup(name, len);
+  *n_names += 1;
+}
 
-	if((hap1 != VCF_GTYPE_MISSING && hap1 != 0 && hap1 != 1)  ||
-	   (hap2 != VCF_GTYPE_MISSING && hap2 != 0 && hap2 != 1)) {
 
-	  /* Copy number polymorphisms and multi-allelic SNPs
-	   * can have values other than 0 and 1 (e.g. 3, 4, ...).
-	   * Combined haplotype test does not currently deal with 
-	   * these. Set the genotypes to MISSING (-1)
-	   */
-	  hap1 = VCF_GTYPE_MISSING;
-	  hap2 = VCF_GTYPE_MISSING;
-	}
 
-	if((n_haps + 2) > expect_haps) {
-	  my_err("%s:%d: more genotypes per line than expected",
-		 __FILE__, __LINE__);
-	}
-	haplotypes[n_haps] = hap1;
-	haplotypes[n_haps+1] = hap2;
+/**
+ * Splits a comma-separated list of sample names. Sets *n_names to
+ * the number of names and returns a list that should be freed with
+ * vcf_free_sample_list.
+ */
+char **vcf_parse_sample_list(const char *str, long *n_names) {
+  char **names;
+  const char *comma;
+  long max_names;
+
+  max_names = VCF_N_SAMPLE_INIT;
+  names = my_new(char *, max_names);
+  *n_names = 0;
+
+  while((comma = strchr(str, ',')) != NULL) {
+    if(comma > str) {
+      vcf_add_sample_name(&names, n_names, &max_names, str, comma - str);
+    }
+    str = comma + 1;
+  }
+  if(*str != '\0') {
+    vcf_add_sample_name(&names, n_names, &max_names, str, strlen(str));
+  }
 
-	n_haps += 2;
-      }
-      
-      i++;
+  return names;
+}
+
+
+
+/**
+ * Reads sample names from a file with one name per line, ignoring
+ * blank lines. Sets *n_names to the number of names and returns a
+ * list that should be freed with vcf_free_sample_list.
+ */
+char **vcf_read_sample_file(const char *path, long *n_names) {
+  FILE *fh;
+  char **names, *line;
+  long max_names;
+
+  fh = util_must_fopen(path, "r");
+
+  max_names = VCF_N_SAMPLE_INIT;
+  names = my_new(char *, max_names);
+  *n_names = 0;
+
+  while((line = util_fgets_line(fh)) != NULL) {
+    util_str_strip(line);
+    if(line[0] != '\0') {
+      vcf_add_sample_name(&names, n_names, &max_names, line, strlen(line));
     }
+    my_free(line);
   }
+  fclose(fh);
+
+  return names;
+}
+
+
+
+void vcf_free_sample_list(char **names, long n_names) {
+  long i;
 
-  if(n_haps != expect_haps) {
-    my_err("%s:%d: expected %ld genotype values per line, but got "
-	   "%ld", __FILE__, __LINE__, expect_haps, n_haps);
+  for(i = 0; i < n_names; i++) {
+    my_free(names[i]);
   }
+  my_free(names);
 }
 
 
 
-void vcf_parse_geno_probs(VCFInfo *vcf_info, float *geno_probs,
-			  char *cur) {
-  /* char delim[] = " \t"; */
-  char delim[] = "\t";
-  char inner_delim[] = ":";
-  char *tok, *inner_tok, *inner_cur;
-  char gtype[VCF_MAX_FORMAT];
-  long gl_idx, i, n, n_geno_probs, expect_geno_probs;
-  float like_homo_ref, like_het, like_homo_alt;
-  float prob_homo_ref, prob_het, prob_homo_alt, prob_sum;
+/* names of genotype probability sources, indexed by VCF_PROB_XXX */
+static const char *vcf_prob_names[] = {"auto", "GL", "PL", "GP"};
 
-  expect_geno_probs = vcf_info->n_samples * 3;
-  
-  /* get index of GL token in format string*/
-  gl_idx = get_format_index(vcf_info->format, "GL");
-  if(gl_idx == -1) {
-    my_err("%s:%d: VCF format string does not specify GL token so cannot "
-	   "obtain genotype probabilities. Format string: '%s'.\n"
-	   "To use this file, you must run snp2h5 without "
-	   "the --geno_prob option.", __FILE__, __LINE__,
-	   vcf_info->format);
+#define VCF_N_PROB_SRC 4
+
+/* names of dosage encodings, indexed by VCF_DOSAGE_XXX */
+static const char *vcf_dosage_names[] = {"none", "float", "half", "uint8"};
+
+#define VCF_N_DOSAGE_TYPE 4
+
+
+
+/**
+ * Parses ':'-delimited format string and records the number of
+ * fields and the indices of the fields we know about in fmt. Also
+ * chooses the field that genotype probabilities are read from,
+ * according to prob_src.
+ */
+void vcf_parse_format(const char *format_str, int prob_src, VCFFormat *fmt) {
+  const char *tok, *end;
+  size_t len;
+  int i;
+
+  fmt->gt_idx = -1;
+  fmt->gl_idx = -1;
+  fmt->pl_idx = -1;
+  fmt->gp_idx = -1;
+  fmt->ds_idx = -1;
+
+  i = 0;
+  tok = format_str;
+  while(TRUE) {
+    end = strchr(tok, ':');
+    len = (end) ? (size_t)(end - tok) : strlen(tok);
+
+    if(len == 2 && strncmp(tok, "GT", 2) == 0) {
+      fmt->gt_idx = i;
+    } else if(len == 2 && strncmp(tok, "GL", 2) == 0) {
+      fmt->gl_idx = i;
+    } else if(len == 2 && strncmp(tok, "PL", 2) == 0) {
+      fmt->pl_idx = i;
+    } else if(len == 2 && strncmp(tok, "GP", 2) == 0) {
+      fmt->gp_idx = i;
+    } else if(len == 2 && strncmp(tok, "DS", 2) == 0) {
+      fmt->ds_idx = i;
+    }
+    i++;
+
+    if(end == NULL) {
+      break;
+    }
+    tok = &end[1];
   }
 
-  n_geno_probs = 0;
-  
-  while((tok = strsep(&cur, delim)) != NULL) {
-    /* each genotype string is delimited by ':'
-     * each GL portion is delimited by ','
-     */
-    util_strncpy(gtype, tok, sizeof(gtype));
-
-    i = 0;
-    inner_cur = gtype;
-    while((i <= gl_idx) && (inner_tok = strsep(&inner_cur, inner_delim)) != NULL) {
-      if(i == gl_idx) {
-	n = sscanf(inner_tok, "%g,%g,%g", &like_homo_ref, &like_het,
-		   &like_homo_alt);
-
-	if(n != 3) {
-	  if(strcmp(inner_tok, ".") == 0) {
-	    /* '.' indicates missing data
-	     * set all likelihoods to log(0.333) = -0.477
-	     */
-	    like_homo_ref = like_het = like_homo_alt = -0.477;
-	  } else {
-	    my_err("%s:%d: failed to parse genotype likelihoods from "
-		   "string '%s'", __FILE__, __LINE__, inner_tok);
-	  }
-	}
+  fmt->n_field = i;
+
+  fmt->prob_idx = -1;
+  fmt->prob_type = VCF_PROB_AUTO;
+  if((prob_src == VCF_PROB_AUTO || prob_src == VCF_PROB_GL) &&
+     fmt->gl_idx >= 0) {
+    fmt->prob_idx = fmt->gl_idx;
+    fmt->prob_type = VCF_PROB_GL;
+  } else if((prob_src == VCF_PROB_AUTO || prob_src == VCF_PROB_PL) &&
+	    fmt->pl_idx >= 0) {
+    fmt->prob_idx = fmt->pl_idx;
+    fmt->prob_type = VCF_PROB_PL;
+  } else if((prob_src == VCF_PROB_AUTO || prob_src == VCF_PROB_GP) &&
+	    fmt->gp_idx >= 0) {
+    fmt->prob_idx = fmt->gp_idx;
+    fmt->prob_type = VCF_PROB_GP;
+  }
+}
 
-	/* convert log10(prob) to prob */
-	prob_homo_ref = pow(10.0, like_homo_ref);
-	prob_het = pow(10.0, like_het);
-	prob_homo_alt = pow(10.0, like_homo_alt);
 
-	if((n_geno_probs + 3) > expect_geno_probs) {
-	  my_err("%s:%d: more genotype likelihoods per line than expected",
-		 __FILE__, __LINE__);
-	}
-	
-	/* most of time probs sum to 1.0, but sometimes they do not
-	 * possibly reflects different likelihoods used for indel 
-	 * calling but not sure. Normalize probs so they sum to 1.0
-	 * This is like getting posterior assuming uniform prior.
-	 */
-	prob_sum = prob_homo_ref + prob_het + prob_homo_alt;
-	prob_homo_ref = prob_homo_ref / prob_sum;
-	prob_het = prob_het / prob_sum;
-	prob_homo_alt = prob_homo_alt / prob_sum;
-     	
-	geno_probs[n_geno_probs] = prob_homo_ref;
-	geno_probs[n_geno_probs + 1] = prob_het;
-	geno_probs[n_geno_probs + 2] = prob_homo_alt;
-
-	n_geno_probs += 3;
-      }
 
-      i++;
+/**
+ * Sets the FORMAT field that genotype probabilities are read from
+ * (one of VCF_PROB_AUTO, VCF_PROB_GL, VCF_PROB_PL, VCF_PROB_GP)
+ */
+void vcf_set_prob_source(VCFInfo *vcf_info, int prob_src) {
+  if(prob_src < 0 || prob_src >= VCF_N_PROB_SRC) {
+    my_err("%s:%d: invalid genotype probability source %d",
+	   __FILE__, __LINE__, prob_src);
+  }
+  vcf_info->prob_src = prob_src;
+  vcf_parse_format(vcf_info->format, prob_src, &vcf_info->fmt);
+}
+
+
+
+/**
+ * Returns the genotype probability source with the provided name
+ * (auto, GL, PL or GP), or -1 if the name is not recognized.
+ */
+int vcf_parse_prob_source(const char *name) {
+  int i;
+
+  for(i = 0; i < VCF_N_PROB_SRC; i++) {
+    if(strcasecmp(name, vcf_prob_names[i]) == 0) {
+      return i;
     }
   }
+  return -1;
+}
+
 
-  if(n_geno_probs != expect_geno_probs) {
-    my_err("%s:%d: expected %ld genotype likelihoods per line, but got "
-	   "%ld", __FILE__, __LINE__, expect_geno_probs, n_geno_probs);
+
+const char *vcf_prob_source_name(int prob_src) {
+  if(prob_src < 0 || prob_src >= VCF_N_PROB_SRC) {
+    return "unknown";
   }
-  
+  return vcf_prob_names[prob_src];
 }
 
 
 
 /**
- * Gets next line of VCF file and parses it into VCFInfo datastructure.
- *
- * If snp->geno_probs is non-null genotype likelihoods are parsed and
- * stored into array pointed to by snp->geno_probs. The array must be of length
- * n_samples*3.
- *
- * If snp->haplotypes is non-null phased genotypes are parsed and
- * stored into array pointed to by snp->haplotypes. The array must be of length
- * n_samples*2.
- *
- * Returns 0 on success, -1 if at EOF.
+ * Sets the encoding of dosages read from DS fields, one of
+ * VCF_DOSAGE_NONE (do not read dosages), VCF_DOSAGE_FLOAT,
+ * VCF_DOSAGE_HALF (IEEE half precision) or VCF_DOSAGE_UINT8.
  */
-int vcf_read_line(gzFile vcf_fh, VCFInfo *vcf_info, SNP *snp) {
-  char *cur, *token;
-  int n_fix_header, ref_len, alt_len;
-  size_t tok_num;
+void vcf_set_dosage_type(VCFInfo *vcf_info, int dosage_type) {
+  if(dosage_type < 0 || dosage_type >= VCF_N_DOSAGE_TYPE) {
+    my_err("%s:%d: invalid dosage type %d", __FILE__, __LINE__,
+	   dosage_type);
+  }
+  vcf_info->dosage_type = dosage_type;
+}
 
-  /* Used to allow space or tab delimiters here but now only allow
-   * tab.  This is because VCF specification indicates that fields
-   * should be tab-delimited, and occasionally some fields contain
-   * spaces.
-   */
-  /* const char delim[] = " \t";*/
-  const char delim[] = "\t";
 
-  n_fix_header = sizeof(vcf_fix_headers) / sizeof(const char *);
 
-  /* read a line */
-  if(util_gzgetline(vcf_fh, &vcf_info->buf, &vcf_info->buf_size) == -1) {
-    return -1;
+/**
+ * Sets whether fixed columns of records are copied (VCF_RECORD_COPY)
+ * or are views into the line they were parsed from (VCF_RECORD_VIEW).
+ * Views avoid copying and have no length limit, but are only valid
+ * until the next record is read from the same reader.
+ */
+void vcf_set_record_mode(VCFInfo *vcf_info, int record_mode) {
+  if(record_mode != VCF_RECORD_COPY && record_mode != VCF_RECORD_VIEW) {
+    my_err("%s:%d: invalid record mode %d", __FILE__, __LINE__,
+	   record_mode);
   }
-  
-  cur = vcf_info->buf;
-  tok_num = 0;
+  vcf_info->record_mode = record_mode;
+}
 
-  /* chrom */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+
+
+/**
+ * Returns the dosage type with the provided name (none, float, half
+ * or uint8), or -1 if the name is not recognized.
+ */
+int vcf_parse_dosage_type(const char *name) {
+  int i;
+
+  for(i = 0; i < VCF_N_DOSAGE_TYPE; i++) {
+    if(strcasecmp(name, vcf_dosage_names[i]) == 0) {
+      return i;
+    }
   }
-  util_strncpy(snp->chrom_name, token, sizeof(snp->chrom_name));
-  
-  
-  /* pos */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+  return -1;
+}
+
+
+
+/**
+ * Returns number of bytes used to store a single dosage
+ */
+size_t vcf_dosage_size(int dosage_type) {
+  switch(dosage_type) {
+  case VCF_DOSAGE_FLOAT:
+    return sizeof(float);
+  case VCF_DOSAGE_HALF:
+    return sizeof(uint16_t);
+  case VCF_DOSAGE_UINT8:
+    return sizeof(uint8_t);
   }
-  snp->pos = util_parse_long(token);
-  
-  /* ID */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+  return 0;
+}
+
+
+
+/**
+ * Converts a float to IEEE half precision, rounding to nearest even
+ */
+static uint16_t vcf_float_to_half(float f) {
+  union { float f; uint32_t u; } v;
+  uint32_t sign, mant, rem, halfway, h;
+  int exp, shift;
+
+  v.f = f;
+  sign = (v.u >> 16) & 0x8000;
+  exp = (int)((v.u >> 23) & 0xff);
+  mant = v.u & 0x7fffff;
+
+  if(exp == 0xff) {
+    /* inf or nan */
+    return sign | 0x7c00 | ((mant) ? 0x200 : 0);
   }
-  util_strncpy(snp->name, token, sizeof(snp->name));
-  
-  /* ref */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+  exp = exp - 127 + 15;
+  if(exp >= 31) {
+    /* too large, becomes inf */
+    return sign | 0x7c00;
   }
-  vcf_info->ref_len = strlen(token);
-  ref_len = util_strncpy(snp->allele1, token, sizeof(snp->allele1));
 
-  if(ref_len != vcf_info->ref_len) {
-    my_warn("truncating long allele (%ld bp) to %ld bp\n",
-	    vcf_info->ref_len, ref_len);
+  if(exp <= 0) {
+    /* subnormal half, or too small and becomes 0 */
+    if(exp < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    shift = 14 - exp;
+    h = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    h = ((uint32_t)exp << 10) | (mant >> 13);
+    rem = mant & 0x1fff;
+    halfway = 0x1000;
   }
-  
-  /* alt */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+
+  /* carry from rounding may propagate into exponent, which is fine */
+  if(rem > halfway || (rem == halfway && (h & 1))) {
+    h++;
   }
-  vcf_info->alt_len = strlen(token);
-  alt_len = util_strncpy(snp->allele2, token, sizeof(snp->allele2));
+  return sign | h;
+}
+
+
 
-  if(alt_len != vcf_info->alt_len) {
-    my_warn("truncating long allele (%ld bp) to %ld bp\n",
-	    vcf_info->alt_len, alt_len);
+static float vcf_half_to_float(uint16_t h) {
+  int exp, mant;
+  float f;
+
+  exp = (h >> 10) & 0x1f;
+  mant = h & 0x3ff;
+
+  if(exp == 0) {
+    f = ldexpf(mant, -24);
+  } else if(exp == 31) {
+    f = (mant) ? NAN : INFINITY;
+  } else {
+    f = ldexpf(mant | 0x400, exp - 25);
   }
+  return (h & 0x8000) ? -f : f;
+}
 
-  /* qual */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+
+
+/**
+ * Stores dosage d (NaN if missing) as the i-th element of dosages
+ */
+static void vcf_set_dosage(int dosage_type, unsigned char *dosages, long i,
+			   float d) {
+  long q;
+
+  switch(dosage_type) {
+  case VCF_DOSAGE_FLOAT:
+    ((float *)dosages)[i] = d;
+    break;
+  case VCF_DOSAGE_HALF:
+    ((uint16_t *)dosages)[i] = vcf_float_to_half(d);
+    break;
+  case VCF_DOSAGE_UINT8:
+    if(isnan(d)) {
+      dosages[i] = VCF_DOSAGE_UINT8_MISSING;
+    } else {
+      q = lrintf(d * VCF_DOSAGE_UINT8_SCALE);
+      dosages[i] = (q < 0) ? 0 : ((q > VCF_DOSAGE_UINT8_MISSING - 1) ?
+				  VCF_DOSAGE_UINT8_MISSING - 1 : q);
+    }
+    break;
   }
-  util_strncpy(vcf_info->qual, token, sizeof(vcf_info->qual));
+}
 
-  /* filter */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+
+
+/**
+ * Returns the i-th dosage from an array of dosages that are encoded
+ * as dosage_type. Missing dosages are returned as NaN.
+ */
+float vcf_get_dosage(int dosage_type, const unsigned char *dosages, long i) {
+  switch(dosage_type) {
+  case VCF_DOSAGE_FLOAT:
+    return ((const float *)dosages)[i];
+  case VCF_DOSAGE_HALF:
+    return vcf_half_to_float(((const uint16_t *)dosages)[i]);
+  case VCF_DOSAGE_UINT8:
+    if(dosages[i] == VCF_DOSAGE_UINT8_MISSING) {
+      return NAN;
+    }
+    return (float)dosages[i] / VCF_DOSAGE_UINT8_SCALE;
   }
-  util_strncpy(vcf_info->filter, token, sizeof(vcf_info->filter));
+  my_err("%s:%d: invalid dosage type %d", __FILE__, __LINE__, dosage_type);
+  return NAN;
+}
 
-  /* info */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+
+
+
+
+/**
+ * Decodes a single allele of a GT field starting at p, which is
+ * either '.' (missing) or a non-negative integer, and stores it in
+ * *allele. Returns a pointer to the first character after the
+ * allele, or NULL if no allele could be decoded.
+ */
+static const char *vcf_parse_allele(const char *p, int *allele) {
+  int val;
+
+  if(*p == '.') {
+    *allele = VCF_GTYPE_MISSING;
+    return p+1;
+  }
+  if(*p < '0' || *p > '9') {
+    return NULL;
   }
-  util_strncpy(vcf_info->info, token, sizeof(vcf_info->info));
 
-  /* format */
-  token = strsep(&cur, delim);
-  if(token == NULL) {
-    my_err("expected at least %d tokens per line\n", n_fix_header);
+  val = 0;
+  while(*p >= '0' && *p <= '9') {
+    /* saturate rather than overflow, large alleles become missing */
+    if(val < 1000000) {
+      val = val * 10 + (*p - '0');
+    }
+    p++;
   }
-  util_strncpy(vcf_info->format, token, sizeof(vcf_info->format));
+  *allele = val;
+  return p;
+}
 
-  snp->has_haplotypes = (get_format_index(vcf_info->format, "GT") >= 0);
-  snp->has_geno_probs = (get_format_index(vcf_info->format, "GL") >= 0);
-  
-  /* now parse haplotypes and/or genotype likelihoods */
-  if(snp->has_geno_probs && snp->geno_probs &&
-     snp->has_haplotypes && snp->haplotypes) {
-    char *cur_copy;    
-    /* Both genotype probs and haplotypes requested.
-     * Need to copy string because it is modified
-     * by the tokenizing in the parsing functions.
-     *
-     * This could be made more efficient by doing the parsing
-     * of both types of data at same time
+
+
+/**
+ * Decodes the diploid GT field at the start of gt_str, which must be
+ * terminated by ':', '\t', '\n' or '\0'. If either allele is not 0
+ * or 1, both are set to VCF_GTYPE_MISSING and *is_other is set to
+ * TRUE. Returns the genotype phase delimiter ('|' or '/') or 0 if the
+ * field could not be parsed.
+ */
+static int vcf_parse_gt(const char *gt_str, char *hap1, char *hap2,
+			char *is_other) {
+  const char *p;
+  int a1, a2, sep;
+
+  p = vcf_parse_allele(gt_str, &a1);
+  if(p == NULL || (*p != '|' && *p != '/')) {
+    return 0;
+  }
+  sep = *p;
+  p = vcf_parse_allele(p+1, &a2);
+  if(p == NULL || !VCF_IS_FIELD_END(*p)) {
+    return 0;
+  }
+
+  if((a1 != VCF_GTYPE_MISSING && a1 != 0 && a1 != 1)  ||
+     (a2 != VCF_GTYPE_MISSING && a2 != 0 && a2 != 1)) {
+    /* Copy number polymorphisms and multi-allelic SNPs
+     * can have values other than 0 and 1 (e.g. 3, 4, ...).
+     * Combined haplotype test does not currently deal with
+     * these. Set the genotypes to MISSING (-1)
      */
-    cur_copy = my_malloc(strlen(cur)+1);
-    strcpy(cur_copy, cur);
-    
-    vcf_parse_geno_probs(vcf_info, snp->geno_probs, cur_copy);
-    my_free(cur_copy);
+    a1 = VCF_GTYPE_MISSING;
+    a2 = VCF_GTYPE_MISSING;
+    *is_other = TRUE;
+  }
+  *hap1 = a1;
+  *hap2 = a2;
 
-    vcf_parse_haplotypes(vcf_info, snp->haplotypes, cur);
-  } else if(snp->has_geno_probs && snp->geno_probs) {
-    vcf_parse_geno_probs(vcf_info, snp->geno_probs, cur);
-  } else if(snp->has_haplotypes && snp->haplotypes) {
-    fprintf(stderr, ".");
-    vcf_parse_haplotypes(vcf_info, snp->haplotypes, cur);
+  return sep;
+}
+
+
+
+#ifdef VCF_GT_SIMD
+
+/**
+ * Packs 8 alleles that are stored one per byte in x into 16 bits,
+ * 2 bits per allele (see SNP_PACKED_GET).
+ */
+static inline uint16_t vcf_pack_haps8(uint64_t x) {
+  x = x | (x >> 6) | (x >> 12) | (x >> 18);
+  return (x & 0xff) | ((x >> 24) & 0xff00);
+}
+
+
+
+/**
+ * Stores 16 decoded alleles (one per byte) of 8 samples, starting at
+ * sample i, either unpacked in haplotypes or, if packed_haps is
+ * non-NULL, packed 2 bits per allele. i must be a multiple of 2.
+ */
+static inline void vcf_store_haps16(__m128i v, long i, char *haplotypes,
+				    unsigned char *packed_haps) {
+  uint64_t x[2];
+  uint16_t p[2];
+
+  if(packed_haps) {
+    _mm_storeu_si128((__m128i *)x, v);
+    p[0] = vcf_pack_haps8(x[0]);
+    p[1] = vcf_pack_haps8(x[1]);
+    memcpy(&packed_haps[i/2], p, sizeof(p));
+  } else {
+    _mm_storeu_si128((__m128i *)&haplotypes[i*2], v);
   }
+}
 
-  /* my_free(line); */
-  return 0;
+
+
+/**
+ * SSE2 fast path for GT-only records where every sample is "a|b\t"
+ * with a and b each '0' or '1'. Decodes 8 samples per iteration
+ * from 32 bytes of the sample columns. Stops at the first block that
+ * does not match this layout, and returns the number of samples
+ * that were decoded. n_sample must not include the last sample on
+ * the line, which is not followed by a tab. Alleles are written to
+ * packed_haps if it is non-NULL, or to haplotypes otherwise.
+ */
+static long vcf_parse_gt_sse2(const char *cur, long n_sample,
+			      char *haplotypes, unsigned char *packed_haps) {
+  const __m128i zero_phased = _mm_set1_epi32(0x09307c30); /* "0|0\t" */
+  const __m128i allele_mask = _mm_set1_epi32(0xfffefffe);
+  __m128i v1, v2;
+  long i;
+
+  for(i = 0; i + 8 <= n_sample; i += 8) {
+    v1 = _mm_loadu_si128((const __m128i *)&cur[i*VCF_GT_STRIDE]);
+    v2 = _mm_loadu_si128((const __m128i *)&cur[i*VCF_GT_STRIDE + 16]);
+
+    /* alleles become 0 or 1, delimiters become 0 */
+    v1 = _mm_xor_si128(v1, zero_phased);
+    v2 = _mm_xor_si128(v2, zero_phased);
+
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(_mm_or_si128(v1, v2),
+							  allele_mask),
+					    _mm_setzero_si128())) != 0xffff) {
+      break;
+    }
+
+    /* each allele is the low byte of a 16 bit word */
+    vcf_store_haps16(_mm_packus_epi16(v1, v2), i, haplotypes, packed_haps);
+  }
+
+  return i;
+}
+
+
+
+/**
+ * AVX2 version of vcf_parse_gt_sse2, which decodes 16 samples from
+ * 64 bytes per iteration.
+ */
+__attribute__((target("avx2")))
+static long vcf_parse_gt_avx2(const char *cur, long n_sample,
+			      char *haplotypes, unsigned char *packed_haps) {
+  const __m256i zero_phased = _mm256_set1_epi32(0x09307c30);
+  const __m256i allele_mask = _mm256_set1_epi32(0xfffefffe);
+  __m256i v1, v2, haps;
+  long i;
+
+  for(i = 0; i + 16 <= n_sample; i += 16) {
+    v1 = _mm256_loadu_si256((const __m256i *)&cur[i*VCF_GT_STRIDE]);
+    v2 = _mm256_loadu_si256((const __m256i *)&cur[i*VCF_GT_STRIDE + 32]);
+    v1 = _mm256_xor_si256(v1, zero_phased);
+    v2 = _mm256_xor_si256(v2, zero_phased);
+
+    if(!_mm256_testz_si256(_mm256_or_si256(v1, v2), allele_mask)) {
+      break;
+    }
+
+    /* packus works within 128 bit lanes, so restore lane order */
+    haps = _mm256_permute4x64_epi64(_mm256_packus_epi16(v1, v2), 0xd8);
+    vcf_store_haps16(_mm256_castsi256_si128(haps), i, haplotypes,
+		     packed_haps);
+    vcf_store_haps16(_mm256_extracti128_si256(haps, 1), i + 8, haplotypes,
+		     packed_haps);
+  }
+
+  /* finish off with SSE2 */
+  return i + vcf_parse_gt_sse2(&cur[i*VCF_GT_STRIDE], n_sample - i,
+			       (packed_haps) ? NULL : &haplotypes[i*2],
+			       (packed_haps) ? &packed_haps[i/2] : NULL);
+}
+
+
+/* set once by vcf_cpu_init, since records may be parsed on several threads */
+static int vcf_has_avx2 = FALSE;
+static pthread_once_t vcf_cpu_once = PTHREAD_ONCE_INIT;
+
+static void vcf_cpu_init() {
+  __builtin_cpu_init();
+  vcf_has_avx2 = __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+}
+
+#endif
+
+
+
+/**
+ * Decodes as many leading samples as possible from GT-only sample
+ * columns using SIMD instructions, if they are available. len is the
+ * length of the cur string. Alleles are written to packed_haps if it
+ * is non-NULL, or to haplotypes otherwise. Returns the number of
+ * samples decoded, which is a multiple of 2; the remaining samples
+ * must be decoded by the scalar parser.
+ */
+long vcf_parse_gt_fixed(const char *cur, long len, long n_samples,
+			char *haplotypes, unsigned char *packed_haps) {
+#ifdef VCF_GT_SIMD
+  long n;
+
+  /* last sample is terminated by end of line rather than '\t', so leave it
+   * to the scalar parser. Also never read past end of line.
+   */
+  n = n_samples - 1;
+  if(len / VCF_GT_STRIDE < n) {
+    n = len / VCF_GT_STRIDE;
+  }
+  if(n <= 0) {
+    return 0;
+  }
+
+  pthread_once(&vcf_cpu_once, vcf_cpu_init);
+  if(vcf_has_avx2) {
+    return vcf_parse_gt_avx2(cur, n, haplotypes, packed_haps);
+  }
+  return vcf_parse_gt_sse2(cur, n, haplotypes, packed_haps);
+#else
+  return 0;
+#endif
+}
+
+
+
+/* exact powers of 10 that can be represented by a double */
+static const double vcf_pow10[] =
+  {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define VCF_POW10_MAX 22
+
+/* lookup tables used by vcf_exp10_neg:
+ * vcf_exp10_int[i] = 10^-i and vcf_exp10_frac[i] = 10^(-i/VCF_EXP10_N_FRAC)
+ */
+static float vcf_exp10_int[VCF_EXP10_N_INT];
+static float vcf_exp10_frac[VCF_EXP10_N_FRAC];
+
+/* vcf_pl_prob[i] = 10^(-i/10), the probability for phred score i */
+static float vcf_pl_prob[VCF_PL_N_TABLE];
+
+static pthread_once_t vcf_prob_once = PTHREAD_ONCE_INIT;
+
+
+
+static void vcf_prob_init() {
+  int i;
+
+  for(i = 0; i < VCF_PL_N_TABLE; i++) {
+    vcf_pl_prob[i] = pow(10.0, -i / 10.0);
+  }
+
+  for(i = 0; i < VCF_EXP10_N_INT; i++) {
+    vcf_exp10_int[i] = pow(10.0, -i);
+  }
+  for(i = 0; i < VCF_EXP10_N_FRAC; i++) {
+    vcf_exp10_frac[i] = pow(10.0, -(double)i / VCF_EXP10_N_FRAC);
+  }
+}
+
+
+
+/**
+ * Returns 10^x for x <= 0 using lookup tables. The remainder that
+ * falls between table entries is handled with a second-order
+ * polynomial, which gives a relative error below 1e-8 (less than
+ * float precision). Returns 0 for x < -(VCF_EXP10_N_INT-1).
+ */
+static float vcf_exp10_neg(float x) {
+  float y, r;
+  int k;
+
+  /* x in units of 1/VCF_EXP10_N_FRAC */
+  y = -x * VCF_EXP10_N_FRAC;
+  if(!(y < (float)(VCF_EXP10_N_INT * VCF_EXP10_N_FRAC))) {
+    return 0.0;
+  }
+  if(y <= 0.0) {
+    return 1.0;
+  }
+  k = (int)y;
+
+  /* 10^-r = e^(-r*ln(10)) */
+  r = (y - k) * (float)(M_LN10 / VCF_EXP10_N_FRAC);
+
+  return vcf_exp10_int[k / VCF_EXP10_N_FRAC] *
+    vcf_exp10_frac[k % VCF_EXP10_N_FRAC] * (1.0f - r + 0.5f*r*r);
+}
+
+
+
+/**
+ * Parses a decimal floating point number (e.g. -0.477, 1e-5) at the
+ * start of str and stores it in *val. Returns a pointer to the first
+ * character after the number, or NULL if str does not start with a
+ * number. Numbers with too many digits or a large exponent are
+ * handed to strtof.
+ */
+static const char *vcf_parse_float(const char *str, float *val) {
+  const char *p;
+  char *end;
+  uint64_t mant;
+  int neg, n_digit, scale, exp, exp_neg;
+  double d;
+
+  p = str;
+  neg = FALSE;
+  if(*p == '-' || *p == '+') {
+    neg = (*p == '-');
+    p++;
+  }
+
+  mant = 0;
+  n_digit = 0;
+  scale = 0;
+  while(*p >= '0' && *p <= '9') {
+    mant = mant * 10 + (*p - '0');
+    n_digit++;
+    p++;
+  }
+  if(*p == '.') {
+    p++;
+    while(*p >= '0' && *p <= '9') {
+      mant = mant * 10 + (*p - '0');
+      n_digit++;
+      scale--;
+      p++;
+    }
+  }
+  if(n_digit == 0) {
+    /* could be nan, inf etc. */
+    goto slow;
+  }
+
+  if(*p == 'e' || *p == 'E') {
+    p++;
+    exp_neg = FALSE;
+    if(*p == '-' || *p == '+') {
+      exp_neg = (*p == '-');
+      p++;
+    }
+    if(*p < '0' || *p > '9') {
+      goto slow;
+    }
+    exp = 0;
+    while(*p >= '0' && *p <= '9' && exp < 10000) {
+      exp = exp * 10 + (*p - '0');
+      p++;
+    }
+    scale += (exp_neg) ? -exp : exp;
+  }
+
+  if(n_digit > 15 || scale < -VCF_POW10_MAX || scale > VCF_POW10_MAX) {
+    /* mantissa or power of 10 may not be exact */
+    goto slow;
+  }
+
+  d = (double)mant;
+  d = (scale < 0) ? d / vcf_pow10[-scale] : d * vcf_pow10[scale];
+  *val = (neg) ? -d : d;
+  return p;
+
+ slow:
+  if(VCF_IS_COL_END(*str) || *str == ' ') {
+    /* strtof would skip whitespace into next column or line */
+    return NULL;
+  }
+  *val = strtof(str, &end);
+  return (end == str) ? NULL : end;
+}
+
+
+
+/**
+ * Parses three comma-delimited floating point numbers from the
+ * sample field at the start of str, which must be terminated by ':',
+ * '\t', '\n' or '\0'. Returns FALSE if the field could not be parsed.
+ */
+static int vcf_parse_float3(const char *str, float *vals) {
+  const char *p;
+  int i;
+
+  p = str;
+  for(i = 0; i < 3; i++) {
+    p = vcf_parse_float(p, &vals[i]);
+    if(p == NULL) {
+      return FALSE;
+    }
+    if(i < 2) {
+      if(*p != ',') {
+	return FALSE;
+      }
+      p++;
+    }
+  }
+  return VCF_IS_FIELD_END(*p);
+}
+
+
+
+/**
+ * Normalizes genotype probabilities so that they sum to 1.0.
+ * Returns FALSE if they cannot be normalized because their sum is
+ * not positive.
+ */
+static int vcf_normalize_probs(float *probs) {
+  float prob_sum;
+
+  prob_sum = probs[0] + probs[1] + probs[2];
+  if(!(prob_sum > 0.0)) {
+    return FALSE;
+  }
+  probs[0] = probs[0] / prob_sum;
+  probs[1] = probs[1] / prob_sum;
+  probs[2] = probs[2] / prob_sum;
+
+  return TRUE;
+}
+
+
+
+/**
+ * Decodes the GL field at the start of gl_str, which contains three
+ * log10-scaled genotype likelihoods, and stores normalized genotype
+ * probabilities in probs. Returns FALSE if the field could not be
+ * parsed.
+ */
+static int vcf_parse_gl(const char *gl_str, float *probs) {
+  float like[3], like_max;
+  int i;
+
+  if(!vcf_parse_float3(gl_str, like)) {
+    return FALSE;
+  }
+
+  /* Convert log10(prob) to prob. The largest likelihood is
+   * subtracted first, so that all exponents are <= 0 and the
+   * largest prob is 1.0, which does not change the normalized probs
+   * below but avoids overflow and underflow.
+   */
+  like_max = like[0];
+  if(like[1] > like_max) {
+    like_max = like[1];
+  }
+  if(like[2] > like_max) {
+    like_max = like[2];
+  }
+  for(i = 0; i < 3; i++) {
+    probs[i] = vcf_exp10_neg(like[i] - like_max);
+  }
+
+  /* most of time probs sum to 1.0, but sometimes they do not
+   * possibly reflects different likelihoods used for indel
+   * calling but not sure. Normalize probs so they sum to 1.0
+   * This is like getting posterior assuming uniform prior.
+   */
+  return vcf_normalize_probs(probs);
+}
+
+
+
+/**
+ * Decodes the PL field at the start of pl_str, which contains three
+ * phred-scaled genotype likelihoods (non-negative integers), and
+ * stores normalized genotype probabilities in probs. Returns FALSE
+ * if the field could not be parsed.
+ */
+static int vcf_parse_pl(const char *pl_str, float *probs) {
+  const char *p;
+  long pl[3], pl_min, d;
+  int i;
+
+  p = pl_str;
+  for(i = 0; i < 3; i++) {
+    if(*p < '0' || *p > '9') {
+      return FALSE;
+    }
+    pl[i] = 0;
+    while(*p >= '0' && *p <= '9') {
+      if(pl[i] < INT_MAX) {
+	pl[i] = pl[i] * 10 + (*p - '0');
+      }
+      p++;
+    }
+    if(i < 2) {
+      if(*p != ',') {
+	return FALSE;
+      }
+      p++;
+    }
+  }
+  if(!VCF_IS_FIELD_END(*p)) {
+    return FALSE;
+  }
+
+  /* PL is normally 0 for the most likely genotype, but subtract the
+   * smallest value in case it is not, so most likely prob is 1.0
+   */
+  pl_min = pl[0];
+  if(pl[1] < pl_min) {
+    pl_min = pl[1];
+  }
+  if(pl[2] < pl_min) {
+    pl_min = pl[2];
+  }
+  for(i = 0; i < 3; i++) {
+    d = pl[i] - pl_min;
+    probs[i] = (d < VCF_PL_N_TABLE) ? vcf_pl_prob[d] :
+      vcf_exp10_neg(d * -0.1f);
+  }
+
+  return vcf_normalize_probs(probs);
+}
+
+
+
+/**
+ * Decodes the GP field at the start of gp_str, which contains three
+ * genotype posterior probabilities. These are normalized so that
+ * they sum to 1.0 (they may not exactly due to rounding) and stored
+ * in probs. Returns FALSE if the field could not be parsed.
+ */
+static int vcf_parse_gp(const char *gp_str, float *probs) {
+  if(!vcf_parse_float3(gp_str, probs)) {
+    return FALSE;
+  }
+  if(probs[0] < 0.0 || probs[1] < 0.0 || probs[2] < 0.0) {
+    return FALSE;
+  }
+  return vcf_normalize_probs(probs);
+}
+
+
+
+/**
+ * Decodes the genotype probability field at the start of str, which
+ * is of type prob_type (VCF_PROB_GL, VCF_PROB_PL or VCF_PROB_GP).
+ * Returns FALSE if the field could not be parsed.
+ */
+static int vcf_parse_probs(const char *str, int prob_type, float *probs) {
+  pthread_once(&vcf_prob_once, vcf_prob_init);
+
+  switch(prob_type) {
+  case VCF_PROB_GL:
+    return vcf_parse_gl(str, probs);
+  case VCF_PROB_PL:
+    return vcf_parse_pl(str, probs);
+  case VCF_PROB_GP:
+    return vcf_parse_gp(str, probs);
+  }
+  my_err("%s:%d: unknown genotype probability type %d",
+	 __FILE__, __LINE__, prob_type);
+  return FALSE;
+}
+
+
+
+/**
+ * Returns TRUE if the sample field starting at p is empty or '.',
+ * which both indicate missing data.
+ */
+static int vcf_field_is_missing(const char *p) {
+  if(*p == '.') {
+    p++;
+  }
+  return VCF_IS_FIELD_END(*p);
+}
+
+
+
+/* records may be parsed on several threads, but the warning about
+ * unphased genotypes is only printed once
+ */
+static pthread_once_t vcf_phase_once = PTHREAD_ONCE_INIT;
+
+static void vcf_warn_phase() {
+  my_warn("%s:%d: some genotypes are unphased (delimited "
+	  "with '/' instead of '|')\n", __FILE__, __LINE__);
+}
+
+
+
+/**
+ * Walks the sample columns in cur once, decoding each of the
+ * requested FORMAT fields of every sample as it is reached. Phased
+ * genotypes are stored in snp->haplotypes and/or snp->packed_haps if
+ * snp->has_haplotypes is set, genotype probabilities are stored in
+ * snp->geno_probs if snp->has_geno_probs is set and dosages are
+ * stored in snp->dosages if snp->has_dosages is set. Genotypes with
+ * alleles other than 0 and 1 are stored as missing, and set
+ * snp->has_other_alleles. Fields that come after the last
+ * requested field in each sample are skipped without being examined,
+ * as are the columns of samples that were not selected (see
+ * vcf_select_samples).
+ */
+void vcf_parse_samples(VCFInfo *vcf_info, SNP *snp, const char *cur) {
+  VCFFormat *fmt;
+  char *haplotypes, hap1, hap2;
+  unsigned char *packed_haps, *unphased;
+  float *geno_probs, ds;
+  unsigned char *dosages;
+  const char *p, *field, *end, *line_end;
+  long n_sample, n_col;
+  int i, n_want, sep;
+
+  fmt = &vcf_info->fmt;
+  /* only parse fields that are present and have been requested */
+  haplotypes = (snp->has_haplotypes) ? snp->haplotypes : NULL;
+  packed_haps = (snp->has_haplotypes) ? snp->packed_haps : NULL;
+  unphased = (haplotypes || packed_haps) ? snp->unphased : NULL;
+  geno_probs = (snp->has_geno_probs) ? snp->geno_probs : NULL;
+  dosages = (snp->has_dosages) ? snp->dosages : NULL;
+
+  /* number of leading fields in each sample that must be examined */
+  n_want = 0;
+  if((haplotypes || packed_haps) && fmt->gt_idx >= n_want) {
+    n_want = fmt->gt_idx + 1;
+  }
+  if(geno_probs && fmt->prob_idx >= n_want) {
+    n_want = fmt->prob_idx + 1;
+  }
+  if(dosages && fmt->ds_idx >= n_want) {
+    n_want = fmt->ds_idx + 1;
+  }
+  if(n_want == 0) {
+    return;
+  }
+  if(unphased) {
+    /* genotypes decoded by the fast path below are all phased */
+    memset(unphased, 0, SNP_UNPHASED_SIZE(vcf_info->n_samples));
+  }
+
+  /* n_sample counts samples that are stored, n_col all sample columns */
+  n_sample = 0;
+  n_col = 0;
+  p = (cur) ? cur : "";
+  line_end = (cur) ? &vcf_info->buf[vcf_info->line_len] : p;
+
+  if(fmt->n_field == 1 && fmt->gt_idx == 0 &&
+     (haplotypes != NULL || packed_haps != NULL) &&
+     (haplotypes == NULL || packed_haps == NULL) &&
+     !dosages && cur && vcf_info->sample_keep == NULL) {
+    /* GT is only field, try fast path for fixed-width genotypes */
+    n_sample = vcf_parse_gt_fixed(cur, line_end - cur, vcf_info->n_samples,
+				  haplotypes, packed_haps);
+    n_col = n_sample;
+    p = &cur[n_sample * VCF_GT_STRIDE];
+  }
+
+  while(!VCF_IS_LINE_END(*p)) {
+    if(n_col >= vcf_info->n_file_samples) {
+      my_err("%s:%d: more samples per line than expected (%ld)",
+	     __FILE__, __LINE__, vcf_info->n_file_samples);
+    }
+
+    if(vcf_info->sample_keep && !vcf_info->sample_keep[n_col]) {
+      /* sample was not selected, skip its column */
+      p = memchr(p, '\t', line_end - p);
+      p = (p) ? p + 1 : line_end;
+      n_col++;
+      continue;
+    }
+
+    /* Each sample column is delimited by ':'. Trailing fields may be
+     * dropped from a sample, in which case they are treated as missing.
+     */
+    for(i = 0; i < n_want; i++) {
+      field = p;
+
+      if(i == fmt->gt_idx && (haplotypes || packed_haps)) {
+	/* The GT portions of the string are delimited by '/' or '|'
+	 * '|' indicates phased, '/' indicates unphased.
+	 */
+	sep = vcf_parse_gt(field, &hap1, &hap2, &snp->has_other_alleles);
+	if(sep == 0) {
+	  if(!vcf_field_is_missing(field)) {
+	    while(!VCF_IS_FIELD_END(*p)) {
+	      p++;
+	    }
+	    my_warn("%s:%d: could not parse genotype string '%.*s'\n",
+		    __FILE__, __LINE__, (int)(p - field), field);
+	  }
+	  hap1 = VCF_GTYPE_MISSING;
+	  hap2 = VCF_GTYPE_MISSING;
+	} else if(sep == '/') {
+	  pthread_once(&vcf_phase_once, vcf_warn_phase);
+	}
+
+	if(haplotypes) {
+	  haplotypes[n_sample*2] = hap1;
+	  haplotypes[n_sample*2 + 1] = hap2;
+	}
+	if(packed_haps) {
+	  SNP_PACKED_SET(packed_haps, n_sample*2, hap1);
+	  SNP_PACKED_SET(packed_haps, n_sample*2 + 1, hap2);
+	}
+	if(unphased && sep != '|') {
+	  /* missing genotypes are not phased either */
+	  SNP_UNPHASED_SET(unphased, n_sample);
+	}
+      }
+
+      if(i == fmt->prob_idx && geno_probs) {
+	/* each GL, PL or GP portion is delimited by ',' */
+	if(!vcf_parse_probs(field, fmt->prob_type, &geno_probs[n_sample*3])) {
+	  if(vcf_field_is_missing(field)) {
+	    /* '.' indicates missing data, use uniform probabilities */
+	    geno_probs[n_sample*3] = 1.0/3.0;
+	    geno_probs[n_sample*3 + 1] = 1.0/3.0;
+	    geno_probs[n_sample*3 + 2] = 1.0/3.0;
+	  } else {
+	    while(!VCF_IS_FIELD_END(*p)) {
+	      p++;
+	    }
+	    my_err("%s:%d: failed to parse genotype probabilities from "
+		   "%s string '%.*s'", __FILE__, __LINE__,
+		   vcf_prob_source_name(fmt->prob_type), (int)(p - field),
+		   field);
+	  }
+	}
+      }
+
+      if(i == fmt->ds_idx && dosages) {
+	end = vcf_parse_float(field, &ds);
+	if(end == NULL || !VCF_IS_FIELD_END(*end)) {
+	  if(!vcf_field_is_missing(field)) {
+	    while(!VCF_IS_FIELD_END(*p)) {
+	      p++;
+	    }
+	    my_err("%s:%d: failed to parse dosage from string '%.*s'",
+		   __FILE__, __LINE__, (int)(p - field), field);
+	  }
+	  ds = NAN;
+	}
+	vcf_set_dosage(vcf_info->dosage_type, dosages, n_sample, ds);
+      }
+
+      /* advance to start of next field */
+      while(!VCF_IS_FIELD_END(*p)) {
+	p++;
+      }
+      if(*p == ':') {
+	p++;
+      }
+    }
+
+    /* skip remaining fields of this sample */
+    while(!VCF_IS_COL_END(*p)) {
+      p++;
+    }
+    if(*p == '\t') {
+      p++;
+    }
+    n_sample++;
+    n_col++;
+  }
+
+  if(n_col != vcf_info->n_file_samples) {
+    my_err("%s:%d: expected %ld samples per line, but got "
+	   "%ld", __FILE__, __LINE__, vcf_info->n_file_samples, n_col);
+  }
+}
+
+
+
+/**
+ * Gets next line of VCF file and parses it into VCFInfo datastructure.
+ *
+ * If snp->geno_probs is non-null genotype likelihoods are parsed and
+ * stored into array pointed to by snp->geno_probs. The array must be of length
+ * n_samples*3.
+ *
+ * If snp->haplotypes is non-null phased genotypes are parsed and
+ * stored into array pointed to by snp->haplotypes. The array must be of length
+ * n_samples*2.
+ *
+ * If snp->packed_haps is non-null phased genotypes are also stored
+ * into it with 2 bits per allele (see SNP_PACKED_GET in snp.h). The
+ * array must be of length SNP_PACKED_SIZE(n_samples*2).
+ *
+ * If snp->unphased is non-null and genotypes are parsed, the bits of
+ * samples whose genotypes are unphased are set in it (see
+ * SNP_UNPHASED_GET). The array must be of length
+ * SNP_UNPHASED_SIZE(n_samples).
+ *
+ * Returns 0 on success, -1 if at EOF.
+ */
+int vcf_read_line(Reader *rd, VCFInfo *vcf_info, SNP *snp) {
+  /* read a line */
+  vcf_info->line_len = reader_getline(rd, &vcf_info->buf);
+  if(vcf_info->line_len == -1) {
+    return -1;
+  }
+
+  vcf_parse_line(vcf_info, snp);
+  
+  return 0;
+}
+
+
+
+/**
+ * Returns the next tab-delimited column of the current line (which
+ * ends at end) and sets *len to its length. *cur is advanced to the
+ * start of the following column, or set to NULL if this is the last
+ * column. Exits with an error if there are no more columns.
+ */
+static const char *vcf_next_col(const char **cur, const char *end,
+				size_t *len) {
+  const char *col, *tab;
+
+  col = *cur;
+  if(col == NULL) {
+    my_err("expected at least %d tokens per line\n",
+	   (int)(sizeof(vcf_fix_headers) / sizeof(const char *)));
+  }
+  tab = memchr(col, '\t', end - col);
+  if(tab) {
+    *len = tab - col;
+    *cur = tab + 1;
+  } else {
+    *len = end - col;
+    *cur = NULL;
+  }
+  return col;
+}
+
+
+
+/**
+ * Returns the index in vcf_info->chrom of the chromosome name of
+ * length len (which need not be '\0'-terminated). Consecutive records
+ * are usually on the same chromosome, so the previous one is checked
+ * before the hash table. Returns -1 if the chromosome is not in the
+ * header, warning the first time each such name is seen unless
+ * warn_chrom is FALSE.
+ */
+int vcf_chrom_id(VCFInfo *vcf_info, const char *name, size_t len) {
+  ChromDict *dict;
+  int id;
+
+  dict = vcf_info->chrom_dict;
+  id = vcf_info->last_chrom;
+  if(id >= 0 && dict->name_lens[id] == len &&
+     memcmp(dict->names[id], name, len) == 0) {
+    return id;
+  }
+
+  id = chrom_dict_lookup(dict, name, len);
+  if(id == -1 && vcf_info->warn_chrom) {
+    if(vcf_info->unknown_chroms == NULL) {
+      vcf_info->unknown_chroms = chrom_dict_new();
+    }
+    if(chrom_dict_lookup(vcf_info->unknown_chroms, name, len) == -1) {
+      chrom_dict_add(vcf_info->unknown_chroms, name, len);
+      my_warn("%s:%d: chromosome '%.*s' is not declared by a contig "
+	      "header line", __FILE__, __LINE__, (int)len, name);
+    }
+  }
+  vcf_info->last_chrom = id;
+
+  return id;
+}
+
+
+
+/**
+ * Copies a column of length len to dest, which has room for n
+ * characters including the terminating '\0'. Returns the number of
+ * characters copied, which is less than len if the column was
+ * truncated.
+ */
+static size_t vcf_copy_col(char *dest, const char *col, size_t len,
+			   size_t n) {
+  if(len > n-1) {
+    len = n-1;
+  }
+  memcpy(dest, col, len);
+  dest[len] = '\0';
+  return len;
+}
+
+
+
+/**
+ * Parses the line that was last read into vcf_info->buf and stores
+ * the result in snp, as described for vcf_read_line.
+ */
+void vcf_parse_line(VCFInfo *vcf_info, SNP *snp) {
+  const char *cur, *end, *token;
+  size_t len;
+  int copy;
+
+  /* Used to allow space or tab delimiters here but now only allow
+   * tab.  This is because VCF specification indicates that fields
+   * should be tab-delimited, and occasionally some fields contain
+   * spaces.
+   *
+   * The line is not modified, because it may be a view into a
+   * memory-mapped file. Columns are copied out of it, or just
+   * referenced in VCF_RECORD_VIEW mode.
+   */
+  cur = vcf_info->buf;
+  end = &vcf_info->buf[vcf_info->line_len];
+  copy = (vcf_info->record_mode == VCF_RECORD_COPY);
+
+  /* chrom */
+  token = vcf_next_col(&cur, end, &len);
+  snp_str_set(&snp->chrom_name, token, len, copy);
+  snp->chrom_id = vcf_chrom_id(vcf_info, token, len);
+  
+  /* pos */
+  token = vcf_next_col(&cur, end, &len);
+  snp->pos = util_parse_long(token);
+  
+  /* ID */
+  token = vcf_next_col(&cur, end, &len);
+  snp_str_set(&snp->name, token, len, copy);
+  
+  /* ref */
+  token = vcf_next_col(&cur, end, &len);
+  vcf_info->ref_len = len;
+  snp_str_set(&snp->allele1, token, len, copy);
+  
+  /* alt */
+  token = vcf_next_col(&cur, end, &len);
+  vcf_info->alt_len = len;
+  snp_str_set(&snp->allele2, token, len, copy);
+
+  /* qual */
+  token = vcf_next_col(&cur, end, &len);
+  snp_str_set(&vcf_info->qual, token, len, copy);
+
+  /* filter */
+  token = vcf_next_col(&cur, end, &len);
+  snp_str_set(&vcf_info->filter, token, len, copy);
+
+  /* info */
+  token = vcf_next_col(&cur, end, &len);
+  snp_str_set(&vcf_info->info, token, len, copy);
+
+  /* format */
+  token = vcf_next_col(&cur, end, &len);
+  if(len >= sizeof(vcf_info->format) ||
+     strncmp(token, vcf_info->format, len) != 0 ||
+     vcf_info->format[len] != '\0') {
+    /* format differs from previous record, so update layout */
+    vcf_copy_col(vcf_info->format, token, len, sizeof(vcf_info->format));
+    vcf_parse_format(vcf_info->format, vcf_info->prob_src, &vcf_info->fmt);
+  }
+
+  snp->has_haplotypes = (vcf_info->fmt.gt_idx >= 0);
+  snp->has_geno_probs = (vcf_info->fmt.prob_idx >= 0);
+  snp->has_dosages = (vcf_info->fmt.ds_idx >= 0 &&
+		      vcf_info->dosage_type != VCF_DOSAGE_NONE);
+  snp->has_other_alleles = FALSE;
+  
+  /* now parse haplotypes and/or genotype likelihoods */
+  vcf_parse_samples(vcf_info, snp, cur);
+}
+
+
+
+
+/**
+ * Parses a region string of the form CHROM, CHROM:START or
+ * CHROM:START-END, where START and END are 1-based inclusive
+ * coordinates that may contain commas. Sets *beg and *end to
+ * 0-based half-open coordinates and returns the chromosome name,
+ * which should be freed when no longer needed.
+ */
+static char *vcf_parse_region_str(const char *region_str, long *beg,
+				  long *end) {
+  char *chrom_name, *coord, *dash, *end_ptr;
+  long start, stop;
+
+  chrom_name = util_str_dup(region_str);
+  *beg = 0;
+  *end = LONG_MAX;
+
+  coord = strrchr(chrom_name, ':');
+  if(coord == NULL) {
+    return chrom_name;
+  }
+
+  util_str_remove_char(&coord[1], ',');
+  start = strtol(&coord[1], &end_ptr, 10);
+  if(end_ptr == &coord[1]) {
+    /* no coordinates after ':', must be part of chromosome name */
+    return chrom_name;
+  }
+  stop = LONG_MAX;
+  dash = end_ptr;
+  if(*dash == '-') {
+    stop = strtol(&dash[1], &end_ptr, 10);
+    if(end_ptr == &dash[1]) {
+      stop = LONG_MAX;
+    }
+  }
+  if(*end_ptr != '\0') {
+    my_err("%s:%d: could not parse region '%s'", __FILE__, __LINE__,
+	   region_str);
+  }
+
+  *coord = '\0';
+  *beg = (start > 0) ? start - 1 : 0;
+  *end = stop;
+
+  if(*end <= *beg) {
+    my_err("%s:%d: region '%s' is empty", __FILE__, __LINE__, region_str);
+  }
+
+  return chrom_name;
+}
+
+
+
+/**
+ * Creates a new region query from a string such as "22:30000000-31000000"
+ * using the provided index. Records from the region are read with
+ * vcf_read_region_line.
+ */
+VCFRegion *vcf_region_new(VCFIndex *idx, const char *region_str) {
+  VCFRegion *region;
+  int tid;
+
+  region = my_new(VCFRegion, 1);
+  region->chrom_name = vcf_parse_region_str(region_str, &region->beg,
+					    &region->end);
+  region->cur_chunk = 0;
+  region->in_chunk = FALSE;
+
+  tid = vcfidx_tid(idx, region->chrom_name);
+  if(tid == -1) {
+    my_warn("%s:%d: index does not contain chromosome '%s'",
+	    __FILE__, __LINE__, region->chrom_name);
+  }
+  region->chunks = vcfidx_query(idx, tid, region->beg, region->end,
+				&region->n_chunk);
+
+  return region;
+}
+
+
+void vcf_region_free(VCFRegion *region) {
+  if(region->chunks) {
+    my_free(region->chunks);
+  }
+  my_free(region->chrom_name);
+  my_free(region);
+}
+
+
+
+/**
+ * Returns the value of the END tag in the provided INFO string
+ * (which may be followed by other tab-delimited fields or the end of
+ * the line), or -1 if there is no END tag.
+ */
+static long vcf_info_end(const char *info) {
+  const char *tag;
+
+  tag = info;
+  while(tag && !VCF_IS_COL_END(*tag)) {
+    if(strncmp(tag, "END=", 4) == 0) {
+      return strtol(&tag[4], NULL, 10);
+    }
+    tag = strpbrk(tag, ";\t\n");
+    if(tag && *tag == ';') {
+      tag += 1;
+    }
+  }
+  return -1;
+}
+
+
+
+/**
+ * Returns the end (0-based, exclusive) of the most recently parsed
+ * record, which is the end of the REF allele unless the INFO
+ * field gives an END position.
+ */
+long vcf_record_end(VCFInfo *vcf_info, SNP *snp) {
+  long end, info_end;
+
+  end = snp->pos - 1 + vcf_info->ref_len;
+  info_end = vcf_info_end(vcf_info->info.str);
+
+  return (info_end > end) ? info_end : end;
+}
+
+
+
+/**
+ * Compares record in provided line to region, without modifying the
+ * line. Returns -1 if the record ends before the region (or is on a
+ * different chromosome), 1 if it starts after the end of the region
+ * and 0 if it overlaps the region.
+ */
+static int vcf_region_cmp(VCFRegion *region, const char *line) {
+  const char *tab, *ref;
+  size_t len;
+  long beg, end, info_end;
+  int i;
+
+  tab = strchr(line, '\t');
+  if(tab == NULL) {
+    return -1;
+  }
+  len = tab - line;
+  if(strncmp(line, region->chrom_name, len) != 0 ||
+     region->chrom_name[len] != '\0') {
+    return -1;
+  }
+
+  beg = strtol(&tab[1], NULL, 10) - 1;
+  if(beg >= region->end) {
+    return 1;
+  }
+
+  /* skip POS and ID fields to get length of REF allele */
+  ref = strchr(&tab[1], '\t');
+  ref = (ref) ? strchr(&ref[1], '\t') : NULL;
+  if(ref == NULL) {
+    return -1;
+  }
+  ref += 1;
+  tab = strchr(ref, '\t');
+  end = beg + ((tab) ? (tab - ref) : strlen(ref));
+
+  if(end <= region->beg && tab) {
+    /* record may still overlap if INFO gives an END position:
+     * skip ALT, QUAL and FILTER fields to get INFO
+     */
+    for(i = 0; i < 3 && tab; i++) {
+      tab = strchr(&tab[1], '\t');
+    }
+    if(tab) {
+      info_end = vcf_info_end(&tab[1]);
+      if(info_end > end) {
+	end = info_end;
+      }
+    }
+  }
+
+  return (end <= region->beg) ? -1 : 0;
+}
+
+
+
+/**
+ * Like vcf_read_line, but only returns records that overlap the
+ * provided region. The reader is moved directly to the parts of the
+ * file that the index says can contain such records, so records
+ * outside the region are (mostly) not read or parsed.
+ *
+ * Returns 0 on success, -1 when there are no more records in the region.
+ */
+int vcf_read_region_line(Reader *rd, VCFInfo *vcf_info, VCFRegion *region,
+			 SNP *snp) {
+  VCFIdxChunk *chunk;
+
+  while(region->cur_chunk < region->n_chunk) {
+    chunk = &region->chunks[region->cur_chunk];
+
+    if(!region->in_chunk) {
+      if((uint64_t)reader_tell(rd) != chunk->beg) {
+	reader_seek(rd, chunk->beg);
+      }
+      region->in_chunk = TRUE;
+    }
+
+    if((uint64_t)reader_tell(rd) >= chunk->end) {
+      /* move on to next chunk */
+      region->cur_chunk += 1;
+      region->in_chunk = FALSE;
+      continue;
+    }
+
+    vcf_info->line_len = reader_getline(rd, &vcf_info->buf);
+    if(vcf_info->line_len == -1) {
+      break;
+    }
+
+    switch(vcf_region_cmp(region, vcf_info->buf)) {
+    case 0:
+      vcf_parse_line(vcf_info, snp);
+      return 0;
+    case 1:
+      /* records are sorted so there are no more in region */
+      region->cur_chunk = region->n_chunk;
+      return -1;
+    }
+  }
+
+  return -1;
+}
+
+
+
+/**
+ * Allocates a batch that can hold up to max_n records of the file
+ * described by vcf_info, whose header must already have been read.
+ * arrays is a combination of VCF_BATCH_HAPLOTYPES,
+ * VCF_BATCH_PACKED_HAPS, VCF_BATCH_GENO_PROBS and VCF_BATCH_DOSAGES
+ * flags that says which genotype matrices are allocated.
+ */
+SNPBatch *vcf_batch_new(VCFInfo *vcf_info, long max_n, int arrays) {
+  SNPBatch *batch;
+
+  if(max_n < 1) {
+    my_err("%s:%d: batch must hold at least 1 record", __FILE__, __LINE__);
+  }
+
+  batch = my_new(SNPBatch, 1);
+  batch->n = 0;
+  batch->max_n = max_n;
+
+  batch->n_haplo_col = vcf_info->n_haplo_col;
+  batch->n_geno_prob_col = vcf_info->n_geno_prob_col;
+  batch->packed_size = SNP_PACKED_SIZE(vcf_info->n_haplo_col);
+  batch->dosage_size = (vcf_info->dosage_type == VCF_DOSAGE_NONE) ? 0 :
+    vcf_dosage_size(vcf_info->dosage_type) * vcf_info->n_samples;
+  batch->unphased_size = SNP_UNPHASED_SIZE(vcf_info->n_samples);
+
+  batch->pos = my_new(long, max_n);
+  batch->end = my_new(long, max_n);
+  batch->chrom_id = my_new(int, max_n);
+  batch->chrom = my_new(char *, max_n);
+  batch->id = my_new(char *, max_n);
+  batch->allele1 = my_new(char *, max_n);
+  batch->allele2 = my_new(char *, max_n);
+  batch->strs = my_arena_new(VCF_BATCH_STR_SZ);
+  batch->chrom_len = my_new(size_t, max_n);
+  batch->id_len = my_new(size_t, max_n);
+  batch->allele1_len = my_new(size_t, max_n);
+  batch->allele2_len = my_new(size_t, max_n);
+
+  batch->has_haplotypes = my_new0(char, max_n);
+  batch->has_geno_probs = my_new0(char, max_n);
+  batch->has_dosages = my_new0(char, max_n);
+  batch->has_other_alleles = my_new0(char, max_n);
+
+  batch->haplotypes = (arrays & VCF_BATCH_HAPLOTYPES) ?
+    my_malloc(sizeof(char) * batch->n_haplo_col * max_n) : NULL;
+  batch->packed_haps = (arrays & VCF_BATCH_PACKED_HAPS) ?
+    my_malloc(batch->packed_size * max_n) : NULL;
+  batch->geno_probs = (arrays & VCF_BATCH_GENO_PROBS) ?
+    my_malloc(sizeof(float) * batch->n_geno_prob_col * max_n) : NULL;
+  batch->dosages = (arrays & VCF_BATCH_DOSAGES && batch->dosage_size) ?
+    my_malloc(batch->dosage_size * max_n) : NULL;
+  batch->unphased = (batch->haplotypes || batch->packed_haps) ?
+    my_malloc(batch->unphased_size * max_n) : NULL;
+
+  snp_init(&batch->snp);
+
+  return batch;
+}
+
+
+
+void vcf_batch_free(SNPBatch *batch) {
+  my_free(batch->pos);
+  my_free(batch->end);
+  my_free(batch->chrom_id);
+  my_free(batch->chrom);
+  my_free(batch->id);
+  my_free(batch->allele1);
+  my_free(batch->allele2);
+  my_arena_free(batch->strs);
+  my_free(batch->chrom_len);
+  my_free(batch->id_len);
+  my_free(batch->allele1_len);
+  my_free(batch->allele2_len);
+  my_free(batch->has_haplotypes);
+  my_free(batch->has_geno_probs);
+  my_free(batch->has_dosages);
+  my_free(batch->has_other_alleles);
+  if(batch->haplotypes) {
+    my_free(batch->haplotypes);
+  }
+  if(batch->packed_haps) {
+    my_free(batch->packed_haps);
+  }
+  if(batch->geno_probs) {
+    my_free(batch->geno_probs);
+  }
+  if(batch->dosages) {
+    my_free(batch->dosages);
+  }
+  if(batch->unphased) {
+    my_free(batch->unphased);
+  }
+  my_free(batch);
+}
+
+
+
+/**
+ * Points the genotype arrays of batch->snp at row i of the batch
+ * matrices
+ */
+static void vcf_batch_set_row(SNPBatch *batch, long i) {
+  SNP *snp;
+
+  snp = &batch->snp;
+  snp->haplotypes = (batch->haplotypes) ?
+    &batch->haplotypes[batch->n_haplo_col * i] : NULL;
+  snp->packed_haps = (batch->packed_haps) ?
+    &batch->packed_haps[batch->packed_size * i] : NULL;
+  snp->geno_probs = (batch->geno_probs) ?
+    &batch->geno_probs[batch->n_geno_prob_col * i] : NULL;
+  snp->dosages = (batch->dosages) ?
+    &batch->dosages[batch->dosage_size * i] : NULL;
+  snp->unphased = (batch->unphased) ?
+    &batch->unphased[batch->unphased_size * i] : NULL;
+}
+
+
+
+/**
+ * Reads up to max_n records (no more than batch->max_n) into batch,
+ * replacing its previous contents. Only records that overlap region
+ * are read if region is non-NULL. Genotypes are parsed directly into
+ * the rows of the batch matrices. Returns the number of records read,
+ * which is less than max_n only at the end of the file (or region).
+ */
+long vcf_read_batch(Reader *rd, VCFInfo *vcf_info, VCFRegion *region,
+		    SNPBatch *batch, long max_n) {
+  SNP *snp;
+  int record_mode, ret;
+  long i;
+
+  if(max_n > batch->max_n) {
+    max_n = batch->max_n;
+  }
+
+  /* fixed columns are copied once, into strs of the batch */
+  record_mode = vcf_info->record_mode;
+  vcf_info->record_mode = VCF_RECORD_VIEW;
+
+  snp = &batch->snp;
+  my_arena_reset(batch->strs);
+  for(i = 0; i < max_n; i++) {
+    vcf_batch_set_row(batch, i);
+    if(region) {
+      ret = vcf_read_region_line(rd, vcf_info, region, snp);
+    } else {
+      ret = vcf_read_line(rd, vcf_info, snp);
+    }
+    if(ret == -1) {
+      break;
+    }
+
+    batch->pos[i] = snp->pos;
+    batch->end[i] = vcf_record_end(vcf_info, snp);
+    batch->chrom_id[i] = snp->chrom_id;
+    if(i > 0 && snp->chrom_id >= 0 && snp->chrom_id == batch->chrom_id[i-1]) {
+      /* share name with previous record on same chromosome */
+      batch->chrom[i] = batch->chrom[i-1];
+    } else {
+      batch->chrom[i] = my_arena_strndup(batch->strs, snp->chrom_name.str,
+					 snp->chrom_name.len);
+    }
+    batch->id[i] = my_arena_strndup(batch->strs, snp->name.str,
+				    snp->name.len);
+    batch->allele1[i] = my_arena_strndup(batch->strs, snp->allele1.str,
+					 snp->allele1.len);
+    batch->allele2[i] = my_arena_strndup(batch->strs, snp->allele2.str,
+					 snp->allele2.len);
+    batch->chrom_len[i] = snp->chrom_name.len;
+    batch->id_len[i] = snp->name.len;
+    batch->allele1_len[i] = snp->allele1.len;
+    batch->allele2_len[i] = snp->allele2.len;
+    batch->has_haplotypes[i] = snp->has_haplotypes;
+    batch->has_geno_probs[i] = snp->has_geno_probs;
+    batch->has_dosages[i] = snp->has_dosages;
+    batch->has_other_alleles[i] = snp->has_other_alleles;
+  }
+  batch->n = i;
+
+  vcf_info->record_mode = record_mode;
+
+  return batch->n;
+}
+
+
+
+/**
+ * Returns record i of the batch as a SNP, whose fixed columns are
+ * views into the batch strings and whose genotype arrays point to
+ * row i of the batch matrices. The SNP is only valid until the next
+ * call to this function or vcf_read_batch.
+ */
+SNP *vcf_batch_snp(SNPBatch *batch, long i) {
+  SNP *snp;
+
+  snp = &batch->snp;
+  vcf_batch_set_row(batch, i);
+
+  snp_str_set(&snp->chrom_name, batch->chrom[i], batch->chrom_len[i],
+	      FALSE);
+  snp_str_set(&snp->name, batch->id[i], batch->id_len[i], FALSE);
+  snp_str_set(&snp->allele1, batch->allele1[i], batch->allele1_len[i],
+	      FALSE);
+  snp_str_set(&snp->allele2, batch->allele2[i], batch->allele2_len[i],
+	      FALSE);
+
+  snp->pos = batch->pos[i];
+  snp->chrom_id = batch->chrom_id[i];
+  snp->has_haplotypes = batch->has_haplotypes[i];
+  snp->has_geno_probs = batch->has_geno_probs[i];
+  snp->has_dosages = batch->has_dosages[i];
+  snp->has_other_alleles = batch->has_other_alleles[i];
+
+  return snp;
 }
@@ -6,49 +6,267 @@
 
 #include "snp.h"
 #include "chrom.h"
+#include "reader.h"
+#include "vcfidx.h"
+#include "memutil.h"
 
-#define VCF_MAX_QUAL 1024
-#define VCF_MAX_FILTER 1024
 #define VCF_MAX_FORMAT 1024
 #define VCF_N_CHROM_INIT 25
 
+/* FORMAT fields that genotype probabilities can be obtained from.
+ * VCF_PROB_AUTO uses the first of GL, PL, GP that is present.
+ */
+#define VCF_PROB_AUTO 0
+#define VCF_PROB_GL 1
+#define VCF_PROB_PL 2
+#define VCF_PROB_GP 3
+
+/* Encodings of dosages (DS) stored in SNP.dosages. VCF_DOSAGE_NONE
+ * means that dosages are not read. Missing dosages are NaN for float
+ * types and VCF_DOSAGE_UINT8_MISSING for VCF_DOSAGE_UINT8, where
+ * dosage d is stored as round(d * VCF_DOSAGE_UINT8_SCALE).
+ */
+#define VCF_DOSAGE_NONE 0
+#define VCF_DOSAGE_FLOAT 1
+#define VCF_DOSAGE_HALF 2
+#define VCF_DOSAGE_UINT8 3
+
+#define VCF_DOSAGE_UINT8_SCALE 127
+#define VCF_DOSAGE_UINT8_MISSING 255
+
+/* How fixed columns of records (SNPStr fields of SNP and VCFInfo)
+ * are stored. VCF_RECORD_COPY copies them into buffers owned by the
+ * SNP and VCFInfo. VCF_RECORD_VIEW makes them views into the current
+ * line, which are only valid until the next record is read.
+ */
+#define VCF_RECORD_COPY 0
+#define VCF_RECORD_VIEW 1
+
+/* genotype matrices that are allocated for a SNPBatch */
+#define VCF_BATCH_HAPLOTYPES 1
+#define VCF_BATCH_PACKED_HAPS 2
+#define VCF_BATCH_GENO_PROBS 4
+#define VCF_BATCH_DOSAGES 8
+
+/* size of blocks of arena that holds strings of a batch */
+#define VCF_BATCH_STR_SZ 4096
+
+/* initial number of entries in a list of sample names */
+#define VCF_N_SAMPLE_INIT 64
+
+
+/**
+ * Layout of a FORMAT string: number of ':'-delimited fields and
+ * indices of fields that we know how to parse (-1 if not present).
+ */
 typedef struct {
+  int n_field;
+  int gt_idx;
+  int gl_idx;
+  int pl_idx;
+  int gp_idx;
+  int ds_idx;
+
+  /* field that genotype probabilities are read from, and its type
+   * (one of VCF_PROB_GL, VCF_PROB_PL, VCF_PROB_GP)
+   */
+  int prob_idx;
+  int prob_type;
+} VCFFormat;
+
+
+typedef struct {
+  /* number of samples that are parsed, which is fewer than the
+   * number of sample columns in the file if a subset was selected
+   */
   long n_samples;
   long n_geno_prob_col;
   long n_haplo_col;
   long n_header_lines;
 
+  /* names of all sample columns, from the #CHROM header line */
+  long n_file_samples;
+  char **sample_names;
 
-  /* records true length of ref / alt alleles, which can be
-   * truncated by limited buffer size of SNP datastructure
+  /* sample_keep[i] is TRUE if sample column i is parsed, NULL if
+   * all columns are parsed
    */
+  char *sample_keep;
+
+
+  /* lengths of ref / alt alleles of current record */
   size_t ref_len;
   size_t alt_len;
 
-  char qual[VCF_MAX_QUAL];
-  char filter[VCF_MAX_FILTER];
-  char info[VCF_MAX_FILTER];
+  SNPStr qual;
+  SNPStr filter;
+  SNPStr info;
+
+  /* kept across records, so always copied */
   char format[VCF_MAX_FORMAT];
 
+  /* layout of format string above, which is only reparsed
+   * when the FORMAT field changes between records
+   */
+  VCFFormat fmt;
+
+  /* requested source of genotype probabilities, VCF_PROB_AUTO by default */
+  int prob_src;
+
+  /* encoding of dosages, VCF_DOSAGE_NONE by default */
+  int dosage_type;
+
+  /* VCF_RECORD_COPY by default */
+  int record_mode;
+
   long n_chrom;
   long max_chrom;
   Chromosome *chrom;
 
-  /* used for reading lines */
-  size_t buf_size;
-  char *buf;
+  /* names of chrom, used to resolve the CHROM column of each record
+   * to an index into chrom (stored as SNP.chrom_id)
+   */
+  ChromDict *chrom_dict;
+
+  /* index of chromosome of previous record, or -1 */
+  int last_chrom;
+
+  /* chromosomes of records that are not in the header, which are
+   * only warned about once (if warn_chrom is TRUE). NULL until one is
+   * seen.
+   */
+  ChromDict *unknown_chroms;
+  int warn_chrom;
+
+  /* current line, which is a read-only view into the reader's
+   * buffer (or memory-mapped file) terminated by '\n' or '\0'
+   */
+  long line_len;
+  const char *buf;
   
   /* could store lots of header info here */
 } VCFInfo;
 
 
 
+/**
+ * Query for records that overlap a region, using a tabix or
+ * CSI index
+ */
+typedef struct {
+  char *chrom_name;
+
+  /* 0-based half-open coordinates of region */
+  long beg;
+  long end;
+
+  /* ranges of virtual file offsets that may contain records in region */
+  int n_chunk;
+  VCFIdxChunk *chunks;
+  int cur_chunk;
+  int in_chunk;
+} VCFRegion;
+
+
+
+/**
+ * Structure-of-arrays batch of up to max_n records. Genotypes of
+ * record i are row i of each genotype matrix, e.g. its haplotypes
+ * are haplotypes[i*n_haplo_col] to haplotypes[(i+1)*n_haplo_col-1].
+ * Matrices that were not requested are NULL.
+ */
+typedef struct {
+  long n;
+  long max_n;
+
+  long n_haplo_col;
+  long n_geno_prob_col;
+  size_t packed_size;
+  size_t dosage_size;
+  size_t unphased_size;
+
+  long *pos;
+  /* end of each record, as returned by vcf_record_end */
+  long *end;
+  /* index of chromosome in VCFInfo, as in SNP.chrom_id */
+  int *chrom_id;
+
+  /* '\0'-terminated CHROM, ID, REF and ALT of each record, which
+   * are allocated from strs and released together when the next
+   * batch is read
+   */
+  char **chrom;
+  char **id;
+  char **allele1;
+  char **allele2;
+  MyArena *strs;
+
+  /* lengths of the strings above, so they are not recounted */
+  size_t *chrom_len;
+  size_t *id_len;
+  size_t *allele1_len;
+  size_t *allele2_len;
+
+  char *has_haplotypes;
+  char *has_geno_probs;
+  char *has_dosages;
+  char *has_other_alleles;
+
+  char *haplotypes;
+  unsigned char *packed_haps;
+  float *geno_probs;
+  unsigned char *dosages;
+
+  /* phase bitmap of each row (see SNP_UNPHASED_GET), allocated if
+   * haplotypes or packed_haps are
+   */
+  unsigned char *unphased;
+
+  /* record that rows are parsed into and returned by vcf_batch_snp */
+  SNP snp;
+} SNPBatch;
+
+
+
 VCFInfo *vcf_info_new();
+VCFInfo *vcf_info_clone(VCFInfo *vcf_info);
 void vcf_info_free();
 
-void vcf_read_header(gzFile vcf_fh, VCFInfo *vcf_info);
+void vcf_read_header(Reader *rd, VCFInfo *vcf_info);
+int vcf_chrom_id(VCFInfo *vcf_info, const char *name, size_t len);
+long vcf_select_samples(VCFInfo *vcf_info, char **names, long n_names,
+			char *found);
+char **vcf_parse_sample_list(const char *str, long *n_names);
+char **vcf_read_sample_file(const char *path, long *n_names);
+void vcf_free_sample_list(char **names, long n_names);
+
+int vcf_read_line(Reader *rd, VCFInfo *vcf_info, SNP *snp);
+void vcf_parse_line(VCFInfo *vcf_info, SNP *snp);
+void vcf_parse_format(const char *format_str, int prob_src, VCFFormat *fmt);
+long vcf_parse_gt_fixed(const char *cur, long len, long n_samples,
+			char *haplotypes, unsigned char *packed_haps);
+void vcf_set_prob_source(VCFInfo *vcf_info, int prob_src);
+int vcf_parse_prob_source(const char *name);
+const char *vcf_prob_source_name(int prob_src);
+
+void vcf_set_dosage_type(VCFInfo *vcf_info, int dosage_type);
+void vcf_set_record_mode(VCFInfo *vcf_info, int record_mode);
+int vcf_parse_dosage_type(const char *name);
+size_t vcf_dosage_size(int dosage_type);
+float vcf_get_dosage(int dosage_type, const unsigned char *dosages,
+		     long i);
+long vcf_record_end(VCFInfo *vcf_info, SNP *snp);
+
+SNPBatch *vcf_batch_new(VCFInfo *vcf_info, long max_n, int arrays);
+void vcf_batch_free(SNPBatch *batch);
+long vcf_read_batch(Reader *rd, VCFInfo *vcf_info, VCFRegion *region,
+		    SNPBatch *batch, long max_n);
+SNP *vcf_batch_snp(SNPBatch *batch, long i);
 
-int vcf_read_line(gzFile vcf_fh, VCFInfo *vcf_info, SNP *snp);
+VCFRegion *vcf_region_new(VCFIndex *idx, const char *region_str);
+void vcf_region_free(VCFRegion *region);
+int vcf_read_region_line(Reader *rd, VCFInfo *vcf_info, VCFRegion *region,
+			 SNP *snp);
 
 
 #endif
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vcf.h"
+#include "vcfcache.h"
+#include "vcfpar.h"
+#include "reader.h"
+#include "bgzf.h"
+#include "snp.h"
+#include "util.h"
+#include "memutil.h"
+
+
+
+void usage(char **argv) {
+  fprintf(stderr, "\nusage: %s [OPTIONS] VCF\n"
+	  "\n"
+	  "Description:\n"
+	  "  This program converts a VCF file (which may be gzipped or\n"
+	  "  bgzipped) to a columnar binary cache (VCF.vcfc) that can be\n"
+	  "  read in place of the VCF much more quickly by vcfmerge.\n"
+	  "  Haplotypes are stored with 2 bits per allele, and\n"
+	  "  genotype probabilities are stored as 16 bit integers.\n"
+	  "\n"
+	  "Options:\n"
+	  "  --output FILE\n"
+	  "               write cache to FILE instead of VCF.vcfc\n"
+	  "  --no-haplotypes\n"
+	  "               do not store haplotypes (GT)\n"
+	  "  --geno-prob FIELD\n"
+	  "               also store genotype probabilities read from FIELD,\n"
+	  "               which is GL, PL, GP or auto\n"
+	  "  --threads N  number of threads used to decompress VCF.gz\n"
+	  "               (default is the number of processors)\n"
+	  "  --parse-threads N\n"
+	  "               parse VCF on N threads, which each parse a chunk\n"
+	  "               of consecutive records (default 0, which parses\n"
+	  "               on the main thread)\n"
+	  "  --samples NAME1,NAME2,...\n"
+	  "               only store genotypes of these samples\n"
+	  "  --samples-file FILE\n"
+	  "               like --samples, but read sample names from FILE,\n"
+	  "               which has one name per line\n"
+	  "  --force      overwrite existing cache file\n"
+	  "\n", argv[0]);
+}
+
+
+
+/**
+ * Streams records of VCF through the parser into the cache writer.
+ * Records are parsed on n_parse_threads worker threads if it is
+ * greater than 0. Only the samples in sample_names are stored if it
+ * is non-NULL.
+ */
+void convert_vcf(const char *vcf_path, const char *cache_path,
+		 uint32_t flags, int prob_src, int n_threads,
+		 int n_parse_threads, char **sample_names,
+		 long n_sample_names) {
+  Reader *rd;
+  VCFInfo *vcf_info;
+  VCFCacheWriter *w;
+  VCFPar *par;
+  SNP snp, *cur_snp;
+  long n_rec;
+  int arrays;
+
+  rd = reader_open(vcf_path, n_threads);
+  vcf_info = vcf_info_new();
+  vcf_read_header(rd, vcf_info);
+  if(sample_names) {
+    vcf_select_samples(vcf_info, sample_names, n_sample_names, NULL);
+  }
+  vcf_set_prob_source(vcf_info, prob_src);
+  /* the writer copies fixed columns into the block it is building */
+  vcf_set_record_mode(vcf_info, VCF_RECORD_VIEW);
+
+  /* haplotypes are parsed directly into packed form used by cache */
+  snp_init(&snp);
+  par = NULL;
+  if(n_parse_threads > 0) {
+    arrays = 0;
+    if(flags & VCFCACHE_HAPLOTYPES) {
+      arrays |= VCFPAR_PACKED_HAPS;
+    }
+    if(flags & VCFCACHE_GENO_PROBS) {
+      arrays |= VCFPAR_GENO_PROBS;
+    }
+    par = vcfpar_new(rd, vcf_info, n_parse_threads, arrays);
+  } else {
+    snp.packed_haps = (flags & VCFCACHE_HAPLOTYPES) ?
+      my_malloc(SNP_PACKED_SIZE(vcf_info->n_haplo_col)) : NULL;
+    snp.unphased = (flags & VCFCACHE_HAPLOTYPES) ?
+      my_malloc(SNP_UNPHASED_SIZE(vcf_info->n_samples)) : NULL;
+    snp.geno_probs = (flags & VCFCACHE_GENO_PROBS) ?
+      my_malloc(sizeof(float) * vcf_info->n_geno_prob_col) : NULL;
+  }
+
+  w = vcfcache_writer_open(cache_path, vcf_info, flags);
+
+  n_rec = 0;
+  while(TRUE) {
+    if(par) {
+      cur_snp = vcfpar_next(par);
+      if(cur_snp == NULL) {
+	break;
+      }
+    } else {
+      if(vcf_read_line(rd, vcf_info, &snp) == -1) {
+	break;
+      }
+      cur_snp = &snp;
+    }
+    vcfcache_write(w, cur_snp);
+    n_rec += 1;
+  }
+  vcfcache_writer_close(w);
+
+  fprintf(stderr, "wrote %ld records to %s\n", n_rec, cache_path);
+
+  if(par) {
+    vcfpar_free(par);
+  }
+  if(snp.packed_haps) {
+    my_free(snp.packed_haps);
+  }
+  if(snp.unphased) {
+    my_free(snp.unphased);
+  }
+  if(snp.geno_probs) {
+    my_free(snp.geno_probs);
+  }
+  vcf_info_free(vcf_info);
+  reader_free(rd);
+}
+
+
+
+int main(int argc, char **argv) {
+  int c, n_threads, n_parse_threads, force, prob_src;
+  uint32_t flags;
+  char *vcf_path, *cache_path, *out_path, **sample_names;
+  long n_sample_names;
+
+  static struct option loptions[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"no-haplotypes", no_argument, NULL, 'n'},
+    {"geno-prob", required_argument, NULL, 'g'},
+    {"threads", required_argument, NULL, 't'},
+    {"parse-threads", required_argument, NULL, 'j'},
+    {"samples", required_argument, NULL, 's'},
+    {"samples-file", required_argument, NULL, 'S'},
+    {"force", no_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  out_path = NULL;
+  flags = VCFCACHE_HAPLOTYPES;
+  prob_src = VCF_PROB_AUTO;
+  n_threads = bgzf_default_threads();
+  n_parse_threads = 0;
+  force = FALSE;
+  sample_names = NULL;
+  n_sample_names = 0;
+
+  while((c = getopt_long(argc, argv, "o:ng:t:j:s:S:fh", loptions, NULL)) != -1) {
+    switch(c) {
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'n':
+      flags &= ~VCFCACHE_HAPLOTYPES;
+      break;
+    case 'g':
+      prob_src = vcf_parse_prob_source(optarg);
+      if(prob_src == -1) {
+	my_err("%s:%d: unknown genotype probability field '%s', expected "
+	       "auto, GL, PL or GP", __FILE__, __LINE__, optarg);
+      }
+      flags |= VCFCACHE_GENO_PROBS;
+      break;
+    case 't':
+      n_threads = util_parse_long(optarg);
+      break;
+    case 'j':
+      n_parse_threads = util_parse_long(optarg);
+      break;
+    case 's':
+    case 'S':
+      if(sample_names) {
+	my_err("%s:%d: samples can only be given once", __FILE__, __LINE__);
+      }
+      sample_names = (c == 's') ?
+	vcf_parse_sample_list(optarg, &n_sample_names) :
+	vcf_read_sample_file(optarg, &n_sample_names);
+      break;
+    case 'f':
+      force = TRUE;
+      break;
+    case 'h':
+      usage(argv);
+      exit(0);
+    default:
+      usage(argv);
+      exit(255);
+    }
+  }
+
+  if(argc - optind != 1) {
+    usage(argv);
+    exit(255);
+  }
+  vcf_path = argv[optind];
+
+  if(out_path) {
+    cache_path = util_str_dup(out_path);
+  } else {
+    cache_path = util_str_concat(vcf_path, ".vcfc", NULL);
+  }
+  if(!force && util_file_exists(cache_path)) {
+    my_err("%s:%d: cache file '%s' already exists, use --force to "
+	   "overwrite it", __FILE__, __LINE__, cache_path);
+  }
+
+  convert_vcf(vcf_path, cache_path, flags, prob_src, n_threads,
+	      n_parse_threads, sample_names, n_sample_names);
+
+  my_free(cache_path);
+  if(sample_names) {
+    vcf_free_sample_list(sample_names, n_sample_names);
+  }
+
+  return 0;
+}
@@ -0,0 +1,921 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vcfcache.h"
+#include "vcf.h"
+#include "snp.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+/*
+ * Columnar binary cache of the records in a VCF file, which can be
+ * read much faster than VCF text. The file is laid out as follows,
+ * with every section starting on an 8 byte boundary:
+ *
+ *   header (VCFCACHE_HEADER_LEN bytes):
+ *     char magic[8], uint32 version, uint32 flags,
+ *     int64 n_samples, int64 n_rec, int64 n_block,
+ *     int64 offset of block index, int64 offset of chromosome table,
+ *     int64 offset of contig table
+ *
+ *   contig table (##contig lines of the VCF header):
+ *     int64 n_contig, then for each: int64 len, uint32 name_len, name,
+ *     uint32 assembly_len, assembly (empty if the line had none),
+ *     followed directly by the sample table (sample names from the
+ *     #CHROM line): for each of n_samples: uint32 name_len, name
+ *
+ *   blocks of up to VCFCACHE_BLOCK_MAX_REC records, each stored as
+ *   columns:
+ *     int64 n_rec, int64 pos[n_rec], uint32 chrom[n_rec],
+ *     uint8 flags[n_rec], then for each of ID, allele1 and allele2:
+ *     uint32 off[n_rec+1] and the concatenated strings, then packed
+ *     haplotypes followed by their phase bitmaps, and quantized
+ *     genotype probabilities, if present
+ *
+ *   chromosome table (names that records refer to):
+ *     int64 n_chrom, then for each: uint32 name_len, name
+ *
+ *   block index: int64 offset[n_block]
+ *
+ * Integers are stored little-endian and are read directly from the
+ * mapped file, so this assumes a little-endian host.
+ */
+
+
+/* haplotypes for each possible byte of packed haplotypes */
+static char vcfcache_hap_table[256][4];
+static pthread_once_t vcfcache_hap_once = PTHREAD_ONCE_INIT;
+
+
+
+static void vcfcache_hap_table_init() {
+  int i, j, code;
+
+  for(i = 0; i < 256; i++) {
+    for(j = 0; j < 4; j++) {
+      code = (i >> (j*2)) & 3;
+      vcfcache_hap_table[i][j] = (code == SNP_PACKED_MISSING) ? -1 : code;
+    }
+  }
+}
+
+
+
+static size_t vcfcache_pad8(size_t len) {
+  return (len + 7) & ~((size_t)7);
+}
+
+
+
+/**
+ * Returns TRUE if the file at path starts with the cache magic string
+ */
+int vcfcache_is_cache(const char *path) {
+  FILE *fh;
+  char magic[VCFCACHE_MAGIC_LEN];
+  int is_cache;
+
+  fh = fopen(path, "rb");
+  if(fh == NULL) {
+    return FALSE;
+  }
+  is_cache = (fread(magic, 1, VCFCACHE_MAGIC_LEN, fh) == VCFCACHE_MAGIC_LEN &&
+	      memcmp(magic, VCFCACHE_MAGIC, VCFCACHE_MAGIC_LEN) == 0);
+  fclose(fh);
+
+  return is_cache;
+}
+
+
+
+/**
+ * Returns a pointer to len bytes at offset in the mapped file,
+ * aborting if they are not all within the file.
+ */
+static const char *vcfcache_ptr(VCFCache *cache, int64_t offset, size_t len) {
+  if(offset < 0 || (size_t)offset > cache->map_len ||
+     len > cache->map_len - (size_t)offset) {
+    my_err("%s:%d: cache file '%s' is truncated or corrupt",
+	   __FILE__, __LINE__, cache->path);
+  }
+  return &cache->map[offset];
+}
+
+
+
+static int64_t vcfcache_get_int64(VCFCache *cache, int64_t offset) {
+  int64_t val;
+  memcpy(&val, vcfcache_ptr(cache, offset, sizeof(val)), sizeof(val));
+  return val;
+}
+
+
+
+static uint32_t vcfcache_get_uint32(VCFCache *cache, int64_t offset) {
+  uint32_t val;
+  memcpy(&val, vcfcache_ptr(cache, offset, sizeof(val)), sizeof(val));
+  return val;
+}
+
+
+
+/**
+ * Reads the contig table into the chromosomes of the VCFInfo.
+ * Returns the offset of the sample table that follows it.
+ */
+static int64_t vcfcache_read_contigs(VCFCache *cache, int64_t offset) {
+  VCFInfo *vcf;
+  uint32_t name_len;
+  long i;
+
+  vcf = cache->vcf;
+  vcf->n_chrom = vcfcache_get_int64(cache, offset);
+  offset += sizeof(int64_t);
+
+  if(vcf->n_chrom > vcf->max_chrom) {
+    vcf->max_chrom = vcf->n_chrom;
+    vcf->chrom = my_realloc(vcf->chrom, sizeof(Chromosome) * vcf->max_chrom);
+  }
+
+  for(i = 0; i < vcf->n_chrom; i++) {
+    vcf->chrom[i].id = i;
+    vcf->chrom[i].len = vcfcache_get_int64(cache, offset);
+    name_len = vcfcache_get_uint32(cache, offset + sizeof(int64_t));
+    offset += sizeof(int64_t) + sizeof(uint32_t);
+    vcf->chrom[i].name = util_str_ndup(vcfcache_ptr(cache, offset, name_len),
+				       name_len);
+    chrom_dict_add(vcf->chrom_dict, vcf->chrom[i].name, name_len);
+    offset += name_len;
+    name_len = vcfcache_get_uint32(cache, offset);
+    offset += sizeof(uint32_t);
+    vcf->chrom[i].assembly = util_str_ndup(vcfcache_ptr(cache, offset,
+							 name_len), name_len);
+    offset += name_len;
+  }
+
+  return offset;
+}
+
+
+
+/**
+ * Reads the sample table into the sample names of the VCFInfo, so
+ * that samples can be selected with vcf_select_samples
+ */
+static void vcfcache_read_samples(VCFCache *cache, int64_t offset) {
+  VCFInfo *vcf;
+  uint32_t name_len;
+  long i;
+
+  vcf = cache->vcf;
+  vcf->sample_names = my_new(char *, cache->n_samples);
+  for(i = 0; i < cache->n_samples; i++) {
+    name_len = vcfcache_get_uint32(cache, offset);
+    offset += sizeof(uint32_t);
+    vcf->sample_names[i] = util_str_ndup(vcfcache_ptr(cache, offset,
+						      name_len), name_len);
+    offset += name_len;
+  }
+  vcf->n_file_samples = cache->n_samples;
+}
+
+
+
+/**
+ * Reads the names of the chromosomes that records refer to, and
+ * resolves them to the contigs read by vcfcache_read_contigs
+ */
+static void vcfcache_read_chroms(VCFCache *cache, int64_t offset) {
+  uint32_t name_len;
+  long i;
+
+  cache->n_chrom = vcfcache_get_int64(cache, offset);
+  offset += sizeof(int64_t);
+  cache->chrom_names = my_new(char *, cache->n_chrom);
+  cache->chrom_ids = my_new(int, cache->n_chrom);
+
+  for(i = 0; i < cache->n_chrom; i++) {
+    name_len = vcfcache_get_uint32(cache, offset);
+    offset += sizeof(uint32_t);
+    cache->chrom_names[i] = util_str_ndup(vcfcache_ptr(cache, offset,
+						       name_len), name_len);
+    cache->chrom_ids[i] = vcf_chrom_id(cache->vcf, cache->chrom_names[i],
+				       name_len);
+    offset += name_len;
+  }
+}
+
+
+
+/**
+ * Memory-maps a cache file and reads its header. The VCFInfo in
+ * cache->vcf is filled in from the header, as if vcf_read_header
+ * had been called on the original VCF. Samples can then be selected
+ * with vcf_select_samples on cache->vcf, and vcfcache_read only
+ * returns genotypes of the selected samples.
+ */
+VCFCache *vcfcache_open(const char *path) {
+  VCFCache *cache;
+  struct stat st;
+  const char *hdr;
+  uint32_t version;
+  int64_t index_offset;
+
+  cache = my_new0(VCFCache, 1);
+  cache->path = util_str_dup(path);
+
+  cache->fd = open(path, O_RDONLY);
+  if(cache->fd == -1) {
+    my_err("%s:%d: could not open cache file '%s'", __FILE__, __LINE__,
+	   path);
+  }
+  if(fstat(cache->fd, &st) != 0) {
+    my_err("%s:%d: could not stat cache file '%s'", __FILE__, __LINE__,
+	   path);
+  }
+  cache->map_len = st.st_size;
+  if(cache->map_len < VCFCACHE_HEADER_LEN) {
+    my_err("%s:%d: cache file '%s' is truncated", __FILE__, __LINE__, path);
+  }
+
+  cache->map = mmap(NULL, cache->map_len, PROT_READ, MAP_PRIVATE,
+		    cache->fd, 0);
+  if(cache->map == MAP_FAILED) {
+    my_err("%s:%d: could not mmap cache file '%s'", __FILE__, __LINE__,
+	   path);
+  }
+  madvise((void *)cache->map, cache->map_len, MADV_SEQUENTIAL);
+
+  hdr = cache->map;
+  if(memcmp(hdr, VCFCACHE_MAGIC, VCFCACHE_MAGIC_LEN) != 0) {
+    my_err("%s:%d: file '%s' is not a VCF cache", __FILE__, __LINE__, path);
+  }
+  version = vcfcache_get_uint32(cache, 8);
+  if(version != VCFCACHE_VERSION) {
+    my_err("%s:%d: cache file '%s' has version %u, but only version %d "
+	   "is supported", __FILE__, __LINE__, path, version,
+	   VCFCACHE_VERSION);
+  }
+  cache->flags = vcfcache_get_uint32(cache, 12);
+  cache->n_samples = vcfcache_get_int64(cache, 16);
+  cache->n_rec = vcfcache_get_int64(cache, 24);
+  cache->n_block = vcfcache_get_int64(cache, 32);
+  index_offset = vcfcache_get_int64(cache, 40);
+  cache->block_offsets = (const int64_t *)
+    vcfcache_ptr(cache, index_offset, sizeof(int64_t) * cache->n_block);
+
+  cache->vcf = vcf_info_new();
+  cache->vcf->n_samples = cache->n_samples;
+  cache->vcf->n_geno_prob_col = cache->n_samples * 3;
+  cache->vcf->n_haplo_col = cache->n_samples * 2;
+  vcfcache_read_samples(cache,
+			vcfcache_read_contigs(cache,
+					      vcfcache_get_int64(cache, 56)));
+  vcfcache_read_chroms(cache, vcfcache_get_int64(cache, 48));
+
+  cache->hap_size = SNP_PACKED_SIZE(cache->n_samples * 2);
+  cache->unphased_size = SNP_UNPHASED_SIZE(cache->n_samples);
+  cache->cur_block = -1;
+  cache->cur_rec = 0;
+  cache->blk.n_rec = 0;
+
+  pthread_once(&vcfcache_hap_once, vcfcache_hap_table_init);
+
+  return cache;
+}
+
+
+
+void vcfcache_close(VCFCache *cache) {
+  long i;
+
+  munmap((void *)cache->map, cache->map_len);
+  close(cache->fd);
+
+  for(i = 0; i < cache->n_chrom; i++) {
+    my_free(cache->chrom_names[i]);
+  }
+  my_free(cache->chrom_names);
+  my_free(cache->chrom_ids);
+  vcf_info_free(cache->vcf);
+  my_free(cache->path);
+  my_free(cache);
+}
+
+
+
+/**
+ * Sets *col to point to the column of len bytes at *offset and
+ * advances *offset past the column and its padding
+ */
+static void vcfcache_map_column(VCFCache *cache, int64_t *offset,
+				size_t len, void *col) {
+  *(const char **)col = vcfcache_ptr(cache, *offset, len);
+  *offset += vcfcache_pad8(len);
+}
+
+
+
+static void vcfcache_map_strings(VCFCache *cache, int64_t *offset,
+				 long n_rec, uint32_t **off, char **data) {
+  vcfcache_map_column(cache, offset, sizeof(uint32_t) * (n_rec + 1), off);
+  vcfcache_map_column(cache, offset, (*off)[n_rec], data);
+}
+
+
+
+/**
+ * Points the columns of cache->blk at block b of the mapped file
+ */
+static void vcfcache_load_block(VCFCache *cache, long b) {
+  VCFCacheBlock *blk;
+  int64_t offset;
+  long n;
+
+  blk = &cache->blk;
+  offset = cache->block_offsets[b];
+  n = blk->n_rec = vcfcache_get_int64(cache, offset);
+  offset += sizeof(int64_t);
+
+  vcfcache_map_column(cache, &offset, sizeof(int64_t) * n, &blk->pos);
+  vcfcache_map_column(cache, &offset, sizeof(uint32_t) * n, &blk->chrom);
+  vcfcache_map_column(cache, &offset, sizeof(uint8_t) * n, &blk->flags);
+  vcfcache_map_strings(cache, &offset, n, &blk->id_off, &blk->id_data);
+  vcfcache_map_strings(cache, &offset, n, &blk->allele1_off,
+		       &blk->allele1_data);
+  vcfcache_map_strings(cache, &offset, n, &blk->allele2_off,
+		       &blk->allele2_data);
+
+  blk->haps = NULL;
+  blk->unphased = NULL;
+  if(cache->flags & VCFCACHE_HAPLOTYPES) {
+    vcfcache_map_column(cache, &offset, cache->hap_size * n, &blk->haps);
+    vcfcache_map_column(cache, &offset, cache->unphased_size * n,
+			&blk->unphased);
+  }
+  blk->probs = NULL;
+  if(cache->flags & VCFCACHE_GENO_PROBS) {
+    vcfcache_map_column(cache, &offset,
+			sizeof(uint16_t) * cache->n_samples * 3 * n,
+			&blk->probs);
+  }
+
+  cache->cur_block = b;
+  cache->cur_rec = 0;
+}
+
+
+
+/**
+ * Sets dest to string i of a string column, either as a copy or as
+ * a view into the mapped cache file.
+ */
+static void vcfcache_get_string(const uint32_t *off, const char *data,
+				long i, SNPStr *dest, int copy) {
+  snp_str_set(dest, &data[off[i]], off[i+1] - off[i], copy);
+}
+
+
+
+/**
+ * Copies the genotypes of the samples that were selected with
+ * vcf_select_samples from a record of the cache into snp, packing
+ * them together in the same way as the VCF parser does
+ */
+static void vcfcache_read_selected(VCFCache *cache, long i, SNP *snp) {
+  VCFCacheBlock *blk;
+  const char *keep;
+  const uint8_t *haps, *unphased;
+  const uint16_t *probs;
+  long j, k;
+
+  blk = &cache->blk;
+  keep = cache->vcf->sample_keep;
+
+  if(snp->has_haplotypes) {
+    haps = &blk->haps[cache->hap_size * i];
+    unphased = &blk->unphased[cache->unphased_size * i];
+    if(snp->unphased) {
+      memset(snp->unphased, 0, SNP_UNPHASED_SIZE(cache->vcf->n_samples));
+    }
+    k = 0;
+    for(j = 0; j < cache->n_samples; j++) {
+      if(!keep[j]) {
+	continue;
+      }
+      if(snp->haplotypes) {
+	snp->haplotypes[k*2] = SNP_PACKED_GET(haps, j*2);
+	snp->haplotypes[k*2+1] = SNP_PACKED_GET(haps, j*2+1);
+      }
+      if(snp->packed_haps) {
+	SNP_PACKED_SET(snp->packed_haps, k*2, SNP_PACKED_CODE(haps, j*2));
+	SNP_PACKED_SET(snp->packed_haps, k*2+1, SNP_PACKED_CODE(haps, j*2+1));
+      }
+      if(snp->unphased && SNP_UNPHASED_GET(unphased, j)) {
+	SNP_UNPHASED_SET(snp->unphased, k);
+      }
+      k += 1;
+    }
+  }
+
+  if(snp->has_geno_probs && snp->geno_probs) {
+    probs = &blk->probs[cache->n_samples * 3 * i];
+    k = 0;
+    for(j = 0; j < cache->n_samples; j++) {
+      if(keep[j]) {
+	snp->geno_probs[k*3] = probs[j*3] * (1.0f / VCFCACHE_PROB_SCALE);
+	snp->geno_probs[k*3+1] = probs[j*3+1] * (1.0f / VCFCACHE_PROB_SCALE);
+	snp->geno_probs[k*3+2] = probs[j*3+2] * (1.0f / VCFCACHE_PROB_SCALE);
+	k += 1;
+      }
+    }
+  }
+}
+
+
+
+/**
+ * Reads next record from cache into snp, in the same way as
+ * vcf_read_line does for VCF text. Returns 0 on success or -1 if
+ * there are no more records.
+ */
+int vcfcache_read(VCFCache *cache, SNP *snp) {
+  VCFCacheBlock *blk;
+  const uint8_t *haps;
+  const uint16_t *probs;
+  long i, j, n_geno_prob_col;
+  uint32_t chrom;
+  int copy;
+
+  blk = &cache->blk;
+  while(cache->cur_rec >= blk->n_rec) {
+    if(cache->cur_block + 1 >= cache->n_block) {
+      return -1;
+    }
+    vcfcache_load_block(cache, cache->cur_block + 1);
+  }
+  i = cache->cur_rec;
+  cache->cur_rec += 1;
+
+  chrom = blk->chrom[i];
+  if(chrom >= cache->n_chrom) {
+    my_err("%s:%d: cache file '%s' is corrupt", __FILE__, __LINE__,
+	   cache->path);
+  }
+  copy = (cache->vcf->record_mode == VCF_RECORD_COPY);
+  snp_str_set(&snp->chrom_name, cache->chrom_names[chrom],
+	      strlen(cache->chrom_names[chrom]), copy);
+  snp->chrom_id = cache->chrom_ids[chrom];
+  snp->pos = blk->pos[i];
+  vcfcache_get_string(blk->id_off, blk->id_data, i, &snp->name, copy);
+  vcfcache_get_string(blk->allele1_off, blk->allele1_data, i,
+		      &snp->allele1, copy);
+  vcfcache_get_string(blk->allele2_off, blk->allele2_data, i,
+		      &snp->allele2, copy);
+  cache->vcf->ref_len = snp->allele1.len;
+  cache->vcf->alt_len = snp->allele2.len;
+
+  snp->has_haplotypes = (blk->flags[i] & VCFCACHE_REC_HAS_HAPLOTYPES) ?
+    TRUE : FALSE;
+  snp->has_geno_probs = (blk->flags[i] & VCFCACHE_REC_HAS_GENO_PROBS) ?
+    TRUE : FALSE;
+  snp->has_dosages = FALSE;
+  snp->has_other_alleles = (blk->flags[i] & VCFCACHE_REC_OTHER_ALLELES) ?
+    TRUE : FALSE;
+
+  if(cache->vcf->sample_keep) {
+    vcfcache_read_selected(cache, i, snp);
+    return 0;
+  }
+
+  if(snp->has_haplotypes) {
+    haps = &blk->haps[cache->hap_size * i];
+    if(snp->packed_haps) {
+      memcpy(snp->packed_haps, haps, cache->hap_size);
+    }
+    if(snp->haplotypes) {
+      /* unpack 4 alleles at a time */
+      for(j = 0; j + 4 <= cache->vcf->n_haplo_col; j += 4) {
+	memcpy(&snp->haplotypes[j], vcfcache_hap_table[haps[j >> 2]], 4);
+      }
+      for(; j < cache->vcf->n_haplo_col; j++) {
+	snp->haplotypes[j] = SNP_PACKED_GET(haps, j);
+      }
+    }
+    if(snp->unphased) {
+      memcpy(snp->unphased, &blk->unphased[cache->unphased_size * i],
+	     cache->unphased_size);
+    }
+  }
+
+  if(snp->has_geno_probs && snp->geno_probs) {
+    n_geno_prob_col = cache->vcf->n_geno_prob_col;
+    probs = &blk->probs[n_geno_prob_col * i];
+    for(j = 0; j < n_geno_prob_col; j++) {
+      snp->geno_probs[j] = probs[j] * (1.0f / VCFCACHE_PROB_SCALE);
+    }
+  }
+
+  return 0;
+}
+
+
+
+/**
+ * Writes zeros to the cache file until the offset is on an 8 byte
+ * boundary
+ */
+static void vcfcache_write_align(VCFCacheWriter *w) {
+  static char zero[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  size_t pad;
+
+  pad = vcfcache_pad8(w->offset) - w->offset;
+  if(pad > 0) {
+    util_must_fwrite(w->fh, zero, pad);
+    w->offset += pad;
+  }
+}
+
+
+
+/**
+ * Writes len bytes to cache file followed by padding to an 8 byte
+ * boundary
+ */
+static void vcfcache_write_padded(VCFCacheWriter *w, const void *buf,
+				  size_t len) {
+  if(len > 0) {
+    util_must_fwrite(w->fh, (void *)buf, len);
+    w->offset += len;
+  }
+  vcfcache_write_align(w);
+}
+
+
+
+static void vcfcache_write_int64(VCFCacheWriter *w, int64_t val) {
+  util_fwrite_one(w->fh, val);
+  w->offset += sizeof(val);
+}
+
+
+
+static void vcfcache_write_name(VCFCacheWriter *w, const char *name) {
+  uint32_t name_len;
+
+  name_len = strlen(name);
+  util_fwrite_one(w->fh, name_len);
+  util_must_fwrite(w->fh, (void *)name, name_len);
+  w->offset += sizeof(name_len) + name_len;
+}
+
+
+
+/**
+ * Writes the fixed-size header at the start of the file. It is
+ * written once when the file is opened and again when it is closed,
+ * once the number of records and offsets are known.
+ */
+static void vcfcache_write_header(VCFCacheWriter *w, int64_t index_offset,
+				  int64_t chrom_offset,
+				  int64_t contig_offset) {
+  uint32_t version;
+  int64_t n;
+
+  if(fseeko(w->fh, 0, SEEK_SET) != 0) {
+    my_err("%s:%d: could not seek in file '%s'", __FILE__, __LINE__,
+	   w->path);
+  }
+  version = VCFCACHE_VERSION;
+  util_must_fwrite(w->fh, VCFCACHE_MAGIC, VCFCACHE_MAGIC_LEN);
+  util_fwrite_one(w->fh, version);
+  util_fwrite_one(w->fh, w->flags);
+  n = w->n_samples;
+  util_fwrite_one(w->fh, n);
+  n = w->n_rec;
+  util_fwrite_one(w->fh, n);
+  n = w->n_block;
+  util_fwrite_one(w->fh, n);
+  util_fwrite_one(w->fh, index_offset);
+  util_fwrite_one(w->fh, chrom_offset);
+  util_fwrite_one(w->fh, contig_offset);
+}
+
+
+
+/**
+ * Creates a new cache file for records of a VCF whose header has
+ * been read into vcf_info. flags specifies which genotype data
+ * (VCFCACHE_HAPLOTYPES, VCFCACHE_GENO_PROBS) are stored.
+ */
+VCFCacheWriter *vcfcache_writer_open(const char *path, VCFInfo *vcf_info,
+				     uint32_t flags) {
+  VCFCacheWriter *w;
+  size_t rec_size;
+  long i;
+
+  w = my_new0(VCFCacheWriter, 1);
+  w->path = util_str_dup(path);
+  w->fh = util_must_fopen(path, "wb");
+  w->flags = flags;
+  w->n_samples = vcf_info->n_samples;
+
+  /* placeholder header, which is rewritten on close */
+  vcfcache_write_header(w, 0, 0, 0);
+  w->offset = VCFCACHE_HEADER_LEN;
+
+  /* contig table goes directly after header */
+  vcfcache_write_int64(w, vcf_info->n_chrom);
+  for(i = 0; i < vcf_info->n_chrom; i++) {
+    vcfcache_write_int64(w, vcf_info->chrom[i].len);
+    vcfcache_write_name(w, vcf_info->chrom[i].name);
+    vcfcache_write_name(w, vcf_info->chrom[i].assembly);
+  }
+
+  /* sample table follows, with names of the samples that are stored */
+  for(i = 0; i < vcf_info->n_file_samples; i++) {
+    if(vcf_info->sample_keep == NULL || vcf_info->sample_keep[i]) {
+      vcfcache_write_name(w, vcf_info->sample_names[i]);
+    }
+  }
+  vcfcache_write_align(w);
+
+  w->max_block = 64;
+  w->block_offsets = my_new(int64_t, w->max_block);
+
+  w->max_chrom = VCFCACHE_N_CHROM_INIT;
+  w->chrom_names = my_new(char *, w->max_chrom);
+  w->last_chrom = -1;
+
+  /* limit number of records per block so that genotype data of a
+   * block stays within VCFCACHE_BLOCK_MAX_BYTES
+   */
+  w->hap_size = SNP_PACKED_SIZE(w->n_samples * 2);
+  w->unphased_size = SNP_UNPHASED_SIZE(w->n_samples);
+  rec_size = 0;
+  if(flags & VCFCACHE_HAPLOTYPES) {
+    rec_size += w->hap_size + w->unphased_size;
+  }
+  if(flags & VCFCACHE_GENO_PROBS) {
+    rec_size += sizeof(uint16_t) * w->n_samples * 3;
+  }
+  w->max_rec = VCFCACHE_BLOCK_MAX_REC;
+  if(rec_size > 0 && VCFCACHE_BLOCK_MAX_BYTES / rec_size < (size_t)w->max_rec) {
+    w->max_rec = VCFCACHE_BLOCK_MAX_BYTES / rec_size;
+    if(w->max_rec < 1) {
+      w->max_rec = 1;
+    }
+  }
+
+  w->blk.n_rec = 0;
+  w->blk.pos = my_new(int64_t, w->max_rec);
+  w->blk.chrom = my_new(uint32_t, w->max_rec);
+  w->blk.flags = my_new(uint8_t, w->max_rec);
+  w->blk.id_off = my_new(uint32_t, w->max_rec + 1);
+  w->blk.allele1_off = my_new(uint32_t, w->max_rec + 1);
+  w->blk.allele2_off = my_new(uint32_t, w->max_rec + 1);
+  w->blk.id_off[0] = w->blk.allele1_off[0] = w->blk.allele2_off[0] = 0;
+  w->max_id = w->max_allele1 = w->max_allele2 = 1024;
+  w->blk.id_data = my_malloc(w->max_id);
+  w->blk.allele1_data = my_malloc(w->max_allele1);
+  w->blk.allele2_data = my_malloc(w->max_allele2);
+  w->blk.haps = (flags & VCFCACHE_HAPLOTYPES) ?
+    my_malloc(w->hap_size * w->max_rec) : NULL;
+  w->blk.unphased = (flags & VCFCACHE_HAPLOTYPES) ?
+    my_malloc(w->unphased_size * w->max_rec) : NULL;
+  w->blk.probs = (flags & VCFCACHE_GENO_PROBS) ?
+    my_malloc(sizeof(uint16_t) * w->n_samples * 3 * w->max_rec) : NULL;
+
+  return w;
+}
+
+
+
+/**
+ * Writes the records of the current block to the file
+ */
+static void vcfcache_flush_block(VCFCacheWriter *w) {
+  VCFCacheBlock *blk;
+  long n;
+
+  blk = &w->blk;
+  n = blk->n_rec;
+  if(n == 0) {
+    return;
+  }
+
+  if(w->n_block == w->max_block) {
+    w->max_block *= 2;
+    w->block_offsets = my_realloc(w->block_offsets,
+				  sizeof(int64_t) * w->max_block);
+  }
+  w->block_offsets[w->n_block] = w->offset;
+  w->n_block += 1;
+
+  vcfcache_write_int64(w, n);
+  vcfcache_write_padded(w, blk->pos, sizeof(int64_t) * n);
+  vcfcache_write_padded(w, blk->chrom, sizeof(uint32_t) * n);
+  vcfcache_write_padded(w, blk->flags, sizeof(uint8_t) * n);
+  vcfcache_write_padded(w, blk->id_off, sizeof(uint32_t) * (n + 1));
+  vcfcache_write_padded(w, blk->id_data, blk->id_off[n]);
+  vcfcache_write_padded(w, blk->allele1_off, sizeof(uint32_t) * (n + 1));
+  vcfcache_write_padded(w, blk->allele1_data, blk->allele1_off[n]);
+  vcfcache_write_padded(w, blk->allele2_off, sizeof(uint32_t) * (n + 1));
+  vcfcache_write_padded(w, blk->allele2_data, blk->allele2_off[n]);
+  if(blk->haps) {
+    vcfcache_write_padded(w, blk->haps, w->hap_size * n);
+    vcfcache_write_padded(w, blk->unphased, w->unphased_size * n);
+  }
+  if(blk->probs) {
+    vcfcache_write_padded(w, blk->probs,
+			  sizeof(uint16_t) * w->n_samples * 3 * n);
+  }
+
+  blk->n_rec = 0;
+}
+
+
+
+/**
+ * Appends str to a string column of the current block
+ */
+static void vcfcache_add_string(uint32_t *off, char **data, size_t *max_len,
+				long i, const SNPStr *str) {
+  while(off[i] + str->len > *max_len) {
+    *max_len *= 2;
+    *data = my_realloc(*data, *max_len);
+  }
+  memcpy(&(*data)[off[i]], str->str, str->len);
+  off[i+1] = off[i] + str->len;
+}
+
+
+
+/**
+ * Returns the index of the chromosome in the cache's chromosome
+ * table, adding it if it is not already present.
+ */
+static uint32_t vcfcache_chrom_index(VCFCacheWriter *w, const SNPStr *name) {
+  long i;
+
+  if(w->last_chrom >= 0 &&
+     snp_str_cmp(name, w->chrom_names[w->last_chrom]) == 0) {
+    return w->last_chrom;
+  }
+
+  for(i = 0; i < w->n_chrom; i++) {
+    if(snp_str_cmp(name, w->chrom_names[i]) == 0) {
+      w->last_chrom = i;
+      return i;
+    }
+  }
+
+  if(w->n_chrom == w->max_chrom) {
+    w->max_chrom *= 2;
+    w->chrom_names = my_realloc(w->chrom_names,
+				sizeof(char *) * w->max_chrom);
+  }
+  w->chrom_names[w->n_chrom] = util_str_ndup(name->str, name->len);
+  w->last_chrom = w->n_chrom;
+  w->n_chrom += 1;
+
+  return w->last_chrom;
+}
+
+
+
+/**
+ * Adds a record that was read by vcf_read_line to the cache.
+ * Haplotypes are taken from snp->packed_haps if it is non-NULL, and
+ * from snp->haplotypes otherwise.
+ */
+void vcfcache_write(VCFCacheWriter *w, SNP *snp) {
+  VCFCacheBlock *blk;
+  uint8_t *haps;
+  uint16_t *probs;
+  long i, j, n_hap, n_prob;
+
+  blk = &w->blk;
+  i = blk->n_rec;
+
+  blk->pos[i] = snp->pos;
+  blk->chrom[i] = vcfcache_chrom_index(w, &snp->chrom_name);
+  vcfcache_add_string(blk->id_off, &blk->id_data, &w->max_id, i, &snp->name);
+  vcfcache_add_string(blk->allele1_off, &blk->allele1_data,
+		      &w->max_allele1, i, &snp->allele1);
+  vcfcache_add_string(blk->allele2_off, &blk->allele2_data,
+		      &w->max_allele2, i, &snp->allele2);
+
+  blk->flags[i] = 0;
+  if(blk->haps) {
+    haps = &blk->haps[w->hap_size * i];
+    n_hap = w->n_samples * 2;
+
+    if(snp->has_haplotypes && snp->packed_haps) {
+      blk->flags[i] |= VCFCACHE_REC_HAS_HAPLOTYPES;
+      memcpy(haps, snp->packed_haps, w->hap_size);
+    } else if(snp->has_haplotypes && snp->haplotypes) {
+      blk->flags[i] |= VCFCACHE_REC_HAS_HAPLOTYPES;
+      memset(haps, 0, w->hap_size);
+      for(j = 0; j < n_hap; j++) {
+	SNP_PACKED_SET(haps, j, snp->haplotypes[j]);
+      }
+    } else {
+      /* all missing */
+      memset(haps, 0xff, w->hap_size);
+    }
+
+    if(snp->has_haplotypes && snp->has_other_alleles) {
+      blk->flags[i] |= VCFCACHE_REC_OTHER_ALLELES;
+    }
+
+    /* phase is only kept if the parser recorded it */
+    if(snp->has_haplotypes && snp->unphased) {
+      memcpy(&blk->unphased[w->unphased_size * i], snp->unphased,
+	     w->unphased_size);
+    } else {
+      memset(&blk->unphased[w->unphased_size * i], 0xff, w->unphased_size);
+    }
+  }
+
+  if(blk->probs) {
+    probs = &blk->probs[w->n_samples * 3 * i];
+    n_prob = w->n_samples * 3;
+
+    if(snp->has_geno_probs && snp->geno_probs) {
+      blk->flags[i] |= VCFCACHE_REC_HAS_GENO_PROBS;
+      for(j = 0; j < n_prob; j++) {
+	probs[j] = lrintf(snp->geno_probs[j] * VCFCACHE_PROB_SCALE);
+      }
+    } else {
+      memset(probs, 0, sizeof(uint16_t) * n_prob);
+    }
+  }
+
+  blk->n_rec += 1;
+  w->n_rec += 1;
+
+  if(blk->n_rec == w->max_rec) {
+    vcfcache_flush_block(w);
+  }
+}
+
+
+
+/**
+ * Writes remaining records, chromosome table and block index, and
+ * closes the cache file
+ */
+void vcfcache_writer_close(VCFCacheWriter *w) {
+  int64_t index_offset, chrom_offset;
+  long i;
+
+  vcfcache_flush_block(w);
+
+  chrom_offset = w->offset;
+  vcfcache_write_int64(w, w->n_chrom);
+  for(i = 0; i < w->n_chrom; i++) {
+    vcfcache_write_name(w, w->chrom_names[i]);
+  }
+  vcfcache_write_align(w);
+
+  index_offset = w->offset;
+  vcfcache_write_padded(w, w->block_offsets, sizeof(int64_t) * w->n_block);
+
+  vcfcache_write_header(w, index_offset, chrom_offset, VCFCACHE_HEADER_LEN);
+  fclose(w->fh);
+
+  for(i = 0; i < w->n_chrom; i++) {
+    my_free(w->chrom_names[i]);
+  }
+  my_free(w->chrom_names);
+  my_free(w->block_offsets);
+  my_free(w->blk.pos);
+  my_free(w->blk.chrom);
+  my_free(w->blk.flags);
+  my_free(w->blk.id_off);
+  my_free(w->blk.allele1_off);
+  my_free(w->blk.allele2_off);
+  my_free(w->blk.id_data);
+  my_free(w->blk.allele1_data);
+  my_free(w->blk.allele2_data);
+  if(w->blk.haps) {
+    my_free(w->blk.haps);
+  }
+  if(w->blk.unphased) {
+    my_free(w->blk.unphased);
+  }
+  if(w->blk.probs) {
+    my_free(w->blk.probs);
+  }
+  my_free(w->path);
+  my_free(w);
+}
@@ -0,0 +1,150 @@
+#ifndef __VCFCACHE_H__
+#define __VCFCACHE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "snp.h"
+#include "vcf.h"
+
+#define VCFCACHE_MAGIC "VCFCACHE"
+#define VCFCACHE_MAGIC_LEN 8
+#define VCFCACHE_VERSION 5
+#define VCFCACHE_HEADER_LEN 64
+
+/* flags that describe which genotype data are stored in a cache */
+#define VCFCACHE_HAPLOTYPES 1
+#define VCFCACHE_GENO_PROBS 2
+
+/* per-record flags, stored in each block */
+#define VCFCACHE_REC_HAS_HAPLOTYPES 1
+#define VCFCACHE_REC_HAS_GENO_PROBS 2
+#define VCFCACHE_REC_OTHER_ALLELES 4
+
+/* genotype probabilities are stored as round(prob * SCALE) */
+#define VCFCACHE_PROB_SCALE 65535
+
+/* a block is written when it has this many records or its genotype
+ * data reaches this many bytes
+ */
+#define VCFCACHE_BLOCK_MAX_REC 4096
+#define VCFCACHE_BLOCK_MAX_BYTES (16 * 1024 * 1024)
+
+#define VCFCACHE_N_CHROM_INIT 32
+
+
+/**
+ * Columns of a block of records. When writing, these are buffers
+ * that are filled as records are added. When reading, they point
+ * into the memory-mapped cache file.
+ */
+typedef struct {
+  long n_rec;
+
+  int64_t *pos;
+  uint32_t *chrom;
+  uint8_t *flags;
+
+  /* strings for record i are at data[off[i]] to data[off[i+1]] */
+  uint32_t *id_off;
+  char *id_data;
+  uint32_t *allele1_off;
+  char *allele1_data;
+  uint32_t *allele2_off;
+  char *allele2_data;
+
+  /* packed haplotypes (see SNP_PACKED_GET), hap_size bytes per record */
+  uint8_t *haps;
+
+  /* phase of genotypes (see SNP_UNPHASED_GET), unphased_size bytes
+   * per record, stored if haps are
+   */
+  uint8_t *unphased;
+
+  /* quantized genotype probabilities, n_samples*3 per record */
+  uint16_t *probs;
+} VCFCacheBlock;
+
+
+/**
+ * Reads records from a memory-mapped cache file
+ */
+typedef struct {
+  char *path;
+  int fd;
+  size_t map_len;
+  const char *map;
+
+  uint32_t flags;
+  long n_samples;
+  long n_rec;
+  long n_block;
+  const int64_t *block_offsets;
+
+  /* chromosome names that records refer to */
+  long n_chrom;
+  char **chrom_names;
+  /* chrom_ids[i] is index of chrom_names[i] in chromosomes of vcf,
+   * or -1 if it is not one of the contigs
+   */
+  int *chrom_ids;
+
+  /* header information, built from the cache header */
+  VCFInfo *vcf;
+
+  /* current block and index of next record within it */
+  long cur_block;
+  long cur_rec;
+  size_t hap_size;
+  size_t unphased_size;
+  VCFCacheBlock blk;
+} VCFCache;
+
+
+/**
+ * Writes records to a new cache file
+ */
+typedef struct {
+  FILE *fh;
+  char *path;
+  uint32_t flags;
+  long n_samples;
+  long n_rec;
+
+  long n_block;
+  long max_block;
+  int64_t *block_offsets;
+
+  /* chromosome names that records refer to, in order of first use */
+  long n_chrom;
+  long max_chrom;
+  char **chrom_names;
+  long last_chrom;
+
+  /* offset in file of next block */
+  int64_t offset;
+
+  /* records of current block, which can hold up to max_rec records */
+  VCFCacheBlock blk;
+  long max_rec;
+  size_t hap_size;
+  size_t unphased_size;
+  size_t max_id;
+  size_t max_allele1;
+  size_t max_allele2;
+} VCFCacheWriter;
+
+
+
+int vcfcache_is_cache(const char *path);
+
+VCFCache *vcfcache_open(const char *path);
+void vcfcache_close(VCFCache *cache);
+int vcfcache_read(VCFCache *cache, SNP *snp);
+
+VCFCacheWriter *vcfcache_writer_open(const char *path, VCFInfo *vcf_info,
+				     uint32_t flags);
+void vcfcache_write(VCFCacheWriter *w, SNP *snp);
+void vcfcache_writer_close(VCFCacheWriter *w);
+
+#endif
@@ -0,0 +1,853 @@
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "vcfidx.h"
+#include "bgzf.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+/*
+ * Reading, querying and building of tabix (.tbi) and CSI (.csi) indexes. Both
+ * formats are described in the SAM/BAM specification documents from
+ * samtools/hts-specs. Index files are BGZF compressed, which zlib
+ * reads as ordinary multi-member gzip. Integers are stored
+ * little-endian and are read directly, so this assumes a
+ * little-endian host.
+ */
+
+
+/**
+ * Returns the number of the first bin at the provided level of the
+ * binning scheme.
+ */
+static int vcfidx_bin_first(int level) {
+  return ((1 << (3 * level)) - 1) / 7;
+}
+
+
+/**
+ * Returns number of the smallest bin that contains the 0-based
+ * half-open interval [beg, end).
+ */
+static uint32_t vcfidx_reg2bin(long beg, long end, int min_shift,
+			       int depth) {
+  int level, shift;
+
+  end -= 1;
+  shift = min_shift;
+  for(level = depth; level > 0; level--) {
+    if((beg >> shift) == (end >> shift)) {
+      return vcfidx_bin_first(level) + (beg >> shift);
+    }
+    shift += 3;
+  }
+  return 0;
+}
+
+
+static int vcfidx_bin_cmp(const void *x, const void *y) {
+  uint32_t b1 = ((const VCFIdxBin *)x)->bin;
+  uint32_t b2 = ((const VCFIdxBin *)y)->bin;
+
+  if(b1 < b2) {
+    return -1;
+  }
+  if(b1 > b2) {
+    return 1;
+  }
+  return 0;
+}
+
+
+static int vcfidx_chunk_cmp(const void *x, const void *y) {
+  uint64_t b1 = ((const VCFIdxChunk *)x)->beg;
+  uint64_t b2 = ((const VCFIdxChunk *)y)->beg;
+
+  if(b1 < b2) {
+    return -1;
+  }
+  if(b1 > b2) {
+    return 1;
+  }
+  return 0;
+}
+
+
+
+/**
+ * Parses the tabix configuration and '\0'-separated sequence names
+ * from the provided buffer, which holds the tabix header (without
+ * the n_ref field). Returns the number of names.
+ */
+static int vcfidx_parse_tbx_header(VCFIndex *idx, const char *buf,
+				   size_t len) {
+  int32_t conf[7], l_nm;
+  const char *nm, *end;
+  int n;
+
+  if(len < sizeof(conf)) {
+    my_err("%s:%d: index header is truncated", __FILE__, __LINE__);
+  }
+  memcpy(conf, buf, sizeof(conf));
+  idx->format = conf[0];
+  idx->col_seq = conf[1];
+  idx->col_beg = conf[2];
+  idx->col_end = conf[3];
+  idx->meta = conf[4];
+  idx->skip = conf[5];
+  l_nm = conf[6];
+
+  if(l_nm < 0 || sizeof(conf) + l_nm > len) {
+    my_err("%s:%d: index sequence names are truncated", __FILE__, __LINE__);
+  }
+
+  /* count and then copy the names */
+  nm = &buf[sizeof(conf)];
+  end = &nm[l_nm];
+  n = 0;
+  while(nm < end) {
+    nm += strlen(nm) + 1;
+    n += 1;
+  }
+
+  idx->names = my_new(char *, n);
+  nm = &buf[sizeof(conf)];
+  n = 0;
+  while(nm < end) {
+    idx->names[n] = util_str_dup(nm);
+    nm += strlen(nm) + 1;
+    n += 1;
+  }
+
+  return n;
+}
+
+
+
+static void vcfidx_read_ref(gzFile gzf, VCFIndex *idx, VCFIdxRef *ref) {
+  int32_t n_bin, n_chunk, n_intv;
+  VCFIdxBin *bin;
+  int i;
+
+  util_gzread_one(gzf, n_bin);
+  ref->n_bin = n_bin;
+  ref->bins = my_new(VCFIdxBin, n_bin);
+
+  for(i = 0; i < n_bin; i++) {
+    bin = &ref->bins[i];
+    util_gzread_one(gzf, bin->bin);
+    if(idx->is_csi) {
+      util_gzread_one(gzf, bin->loffset);
+    } else {
+      bin->loffset = 0;
+    }
+    util_gzread_one(gzf, n_chunk);
+    bin->n_chunk = n_chunk;
+    bin->chunks = my_new(VCFIdxChunk, n_chunk);
+    util_must_gzread(gzf, bin->chunks, sizeof(VCFIdxChunk) * n_chunk);
+  }
+  qsort(ref->bins, ref->n_bin, sizeof(VCFIdxBin), vcfidx_bin_cmp);
+
+  if(idx->is_csi) {
+    ref->n_intv = 0;
+    ref->intv = NULL;
+  } else {
+    util_gzread_one(gzf, n_intv);
+    ref->n_intv = n_intv;
+    ref->intv = my_new(uint64_t, n_intv);
+    util_must_gzread(gzf, ref->intv, sizeof(uint64_t) * n_intv);
+  }
+}
+
+
+
+/**
+ * Reads a tabix or CSI index from the file with the provided path.
+ */
+VCFIndex *vcfidx_read_file(const char *idx_path) {
+  VCFIndex *idx;
+  gzFile gzf;
+  char magic[4], *buf;
+  int32_t n_ref, min_shift, depth, l_aux, l_nm, conf[6];
+  int n_names, i;
+
+  /* set by each format's header, but -Wall cannot tell that my_err
+   * does not return
+   */
+  n_names = 0;
+  n_ref = 0;
+
+  gzf = util_must_gzopen(idx_path, "rb");
+  util_must_gzread(gzf, magic, sizeof(magic));
+
+  idx = my_new0(VCFIndex, 1);
+
+  if(memcmp(magic, "TBI\1", 4) == 0) {
+    idx->is_csi = FALSE;
+    idx->min_shift = VCFIDX_TBI_MIN_SHIFT;
+    idx->depth = VCFIDX_TBI_DEPTH;
+
+    util_gzread_one(gzf, n_ref);
+    util_must_gzread(gzf, conf, sizeof(conf));
+    util_gzread_one(gzf, l_nm);
+
+    buf = my_malloc(sizeof(conf) + sizeof(l_nm) + l_nm);
+    memcpy(buf, conf, sizeof(conf));
+    memcpy(&buf[sizeof(conf)], &l_nm, sizeof(l_nm));
+    util_must_gzread(gzf, &buf[sizeof(conf) + sizeof(l_nm)], l_nm);
+    n_names = vcfidx_parse_tbx_header(idx, buf,
+				      sizeof(conf) + sizeof(l_nm) + l_nm);
+    my_free(buf);
+  } else if(memcmp(magic, "CSI\1", 4) == 0) {
+    idx->is_csi = TRUE;
+
+    util_gzread_one(gzf, min_shift);
+    util_gzread_one(gzf, depth);
+    util_gzread_one(gzf, l_aux);
+    idx->min_shift = min_shift;
+    idx->depth = depth;
+
+    if(l_aux <= 0) {
+      my_err("%s:%d: CSI index '%s' does not contain sequence names",
+	     __FILE__, __LINE__, idx_path);
+    }
+    buf = my_malloc(l_aux);
+    util_must_gzread(gzf, buf, l_aux);
+    n_names = vcfidx_parse_tbx_header(idx, buf, l_aux);
+    my_free(buf);
+
+    util_gzread_one(gzf, n_ref);
+  } else {
+    my_err("%s:%d: '%s' is not a tabix or CSI index", __FILE__, __LINE__,
+	   idx_path);
+  }
+
+  if(n_names != n_ref) {
+    my_err("%s:%d: index '%s' has %d sequences but %d sequence names",
+	   __FILE__, __LINE__, idx_path, n_ref, n_names);
+  }
+
+  idx->n_ref = n_ref;
+  idx->refs = my_new(VCFIdxRef, n_ref);
+  for(i = 0; i < n_ref; i++) {
+    vcfidx_read_ref(gzf, idx, &idx->refs[i]);
+  }
+
+  gzclose(gzf);
+
+  return idx;
+}
+
+
+
+/**
+ * Loads the index for the VCF file with the provided path. Looks
+ * for a tabix index (VCF path + ".tbi") first and then a CSI index
+ * (VCF path + ".csi").
+ */
+VCFIndex *vcfidx_load(const char *vcf_path) {
+  VCFIndex *idx;
+  char *idx_path;
+
+  idx_path = util_str_concat(vcf_path, ".tbi", NULL);
+  if(!util_file_exists(idx_path)) {
+    my_free(idx_path);
+    idx_path = util_str_concat(vcf_path, ".csi", NULL);
+    if(!util_file_exists(idx_path)) {
+      my_err("%s:%d: could not find index file '%s.tbi' or '%s.csi'",
+	     __FILE__, __LINE__, vcf_path, vcf_path);
+    }
+  }
+
+  idx = vcfidx_read_file(idx_path);
+  my_free(idx_path);
+
+  return idx;
+}
+
+
+
+void vcfidx_free(VCFIndex *idx) {
+  int i, j;
+
+  for(i = 0; i < idx->n_ref; i++) {
+    for(j = 0; j < idx->refs[i].n_bin; j++) {
+      my_free(idx->refs[i].bins[j].chunks);
+    }
+    my_free(idx->refs[i].bins);
+    if(idx->refs[i].intv) {
+      my_free(idx->refs[i].intv);
+    }
+    my_free(idx->names[i]);
+  }
+  my_free(idx->refs);
+  my_free(idx->names);
+  my_free(idx);
+}
+
+
+
+/**
+ * Returns the index of the sequence with the provided name, or -1
+ * if the index has no such sequence.
+ */
+int vcfidx_tid(VCFIndex *idx, const char *chrom_name) {
+  int i;
+
+  for(i = 0; i < idx->n_ref; i++) {
+    if(strcmp(idx->names[i], chrom_name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+static VCFIdxBin *vcfidx_find_bin(VCFIdxRef *ref, uint32_t bin_num) {
+  VCFIdxBin key;
+
+  key.bin = bin_num;
+  return bsearch(&key, ref->bins, ref->n_bin, sizeof(VCFIdxBin),
+		 vcfidx_bin_cmp);
+}
+
+
+/**
+ * Returns the smallest virtual offset that a record overlapping
+ * position beg can have.
+ */
+static uint64_t vcfidx_min_offset(VCFIndex *idx, VCFIdxRef *ref, long beg) {
+  VCFIdxBin *bin;
+  long i;
+  uint32_t bin_num;
+
+  if(!idx->is_csi) {
+    /* use linear index */
+    if(ref->n_intv == 0) {
+      return 0;
+    }
+    i = beg >> idx->min_shift;
+    if(i >= ref->n_intv) {
+      i = ref->n_intv - 1;
+    }
+    return ref->intv[i];
+  }
+
+  /* use offset from smallest existing bin that contains beg */
+  bin_num = vcfidx_bin_first(idx->depth) + (beg >> idx->min_shift);
+  while(TRUE) {
+    bin = vcfidx_find_bin(ref, bin_num);
+    if(bin) {
+      return bin->loffset;
+    }
+    if(bin_num == 0) {
+      break;
+    }
+    bin_num = (bin_num - 1) >> 3;
+  }
+  return 0;
+}
+
+
+
+/**
+ * Returns a sorted, non-overlapping array of virtual offset ranges
+ * that contain all records from sequence tid that overlap the 0-based
+ * half-open interval [beg, end). Sets *n_chunk to the length of the
+ * returned array, which should be freed when no longer needed.
+ */
+VCFIdxChunk *vcfidx_query(VCFIndex *idx, int tid, long beg, long end,
+			  int *n_chunk) {
+  VCFIdxRef *ref;
+  VCFIdxBin *bin;
+  VCFIdxChunk *chunks;
+  uint64_t min_off;
+  long b, e, max_end;
+  int level, shift, i, j, n, max_chunk;
+
+  *n_chunk = 0;
+
+  if(tid < 0 || tid >= idx->n_ref) {
+    return NULL;
+  }
+  ref = &idx->refs[tid];
+
+  if(beg < 0) {
+    beg = 0;
+  }
+  max_end = 1L << (idx->min_shift + idx->depth * 3);
+  if(end > max_end) {
+    end = max_end;
+  }
+  if(beg >= end) {
+    return NULL;
+  }
+
+  min_off = vcfidx_min_offset(idx, ref, beg);
+
+  max_chunk = 16;
+  chunks = my_new(VCFIdxChunk, max_chunk);
+  n = 0;
+
+  /* visit every bin that overlaps the region at each level */
+  shift = idx->min_shift + idx->depth * 3;
+  for(level = 0; level <= idx->depth; level++) {
+    b = vcfidx_bin_first(level) + (beg >> shift);
+    e = vcfidx_bin_first(level) + ((end - 1) >> shift);
+
+    for(i = b; i <= e; i++) {
+      bin = vcfidx_find_bin(ref, i);
+      if(bin == NULL) {
+	continue;
+      }
+      for(j = 0; j < bin->n_chunk; j++) {
+	if(bin->chunks[j].end <= min_off) {
+	  continue;
+	}
+	if(n >= max_chunk) {
+	  max_chunk *= 2;
+	  chunks = my_realloc(chunks, sizeof(VCFIdxChunk) * max_chunk);
+	}
+	chunks[n] = bin->chunks[j];
+	n += 1;
+      }
+    }
+    shift -= 3;
+  }
+
+  if(n == 0) {
+    my_free(chunks);
+    return NULL;
+  }
+
+  /* sort chunks and merge those that overlap */
+  qsort(chunks, n, sizeof(VCFIdxChunk), vcfidx_chunk_cmp);
+  j = 0;
+  for(i = 1; i < n; i++) {
+    if(chunks[i].beg <= chunks[j].end) {
+      if(chunks[i].end > chunks[j].end) {
+	chunks[j].end = chunks[i].end;
+      }
+    } else {
+      j += 1;
+      chunks[j] = chunks[i];
+    }
+  }
+
+  *n_chunk = j + 1;
+  return chunks;
+}
+
+
+
+
+/**
+ * Creates a new index builder. TBI indexes always use a min_shift of
+ * 14 and depth of 5, which limits them to sequences shorter than
+ * 2^29 bp. For CSI indexes the depth is chosen so that sequences of
+ * length max_len can be indexed.
+ */
+VCFIdxBuilder *vcfidx_builder_new(int is_csi, int min_shift, long max_len) {
+  VCFIdxBuilder *b;
+  VCFIndex *idx;
+  int i;
+
+  b = my_new0(VCFIdxBuilder, 1);
+  idx = b->idx = my_new0(VCFIndex, 1);
+
+  idx->is_csi = is_csi;
+  if(is_csi) {
+    idx->min_shift = min_shift;
+    idx->depth = 1;
+    while((1L << (min_shift + idx->depth * 3)) < max_len) {
+      idx->depth += 1;
+    }
+  } else {
+    idx->min_shift = VCFIDX_TBI_MIN_SHIFT;
+    idx->depth = VCFIDX_TBI_DEPTH;
+  }
+
+  idx->format = VCFIDX_TBX_VCF;
+  idx->col_seq = 1;
+  idx->col_beg = 2;
+  idx->col_end = 0;
+  idx->meta = '#';
+  idx->skip = 0;
+
+  b->max_ref = VCFIDX_N_REF_INIT;
+  idx->names = my_new(char *, b->max_ref);
+  idx->refs = my_new(VCFIdxRef, b->max_ref);
+  idx->n_ref = 0;
+  b->tid = -1;
+  b->chrom_id = -1;
+
+  /* leave room for the pseudo-bin that holds per-sequence statistics */
+  b->n_bin_slot = vcfidx_bin_first(idx->depth + 1) + 2;
+  b->bin_slot = my_new(int, b->n_bin_slot);
+  for(i = 0; i < b->n_bin_slot; i++) {
+    b->bin_slot[i] = -1;
+  }
+
+  return b;
+}
+
+
+
+/**
+ * Returns the bin with the provided number in the current reference
+ * sequence, creating it if necessary
+ */
+static VCFIdxBin *vcfidx_builder_get_bin(VCFIdxBuilder *b,
+					 uint32_t bin_num) {
+  VCFIdxRef *ref;
+  VCFIdxBin *bin;
+
+  ref = &b->idx->refs[b->tid];
+
+  if(b->bin_slot[bin_num] == -1) {
+    if(ref->n_bin >= b->max_bin) {
+      b->max_bin *= 2;
+      ref->bins = my_realloc(ref->bins, sizeof(VCFIdxBin) * b->max_bin);
+    }
+    bin = &ref->bins[ref->n_bin];
+    bin->bin = bin_num;
+    bin->loffset = 0;
+    bin->n_chunk = 0;
+    bin->chunks = my_new(VCFIdxChunk, 1);
+    b->bin_slot[bin_num] = ref->n_bin;
+    ref->n_bin += 1;
+  }
+  return &ref->bins[b->bin_slot[bin_num]];
+}
+
+
+
+/**
+ * Appends chunk to the chunks of bin
+ */
+static void vcfidx_bin_append(VCFIdxBin *bin, const VCFIdxChunk *chunk) {
+  /* chunk array is grown each time its length reaches a power of 2 */
+  if(bin->n_chunk > 0 && (bin->n_chunk & (bin->n_chunk - 1)) == 0) {
+    bin->chunks = my_realloc(bin->chunks,
+			     sizeof(VCFIdxChunk) * bin->n_chunk * 2);
+  }
+  bin->chunks[bin->n_chunk] = *chunk;
+  bin->n_chunk += 1;
+}
+
+
+
+/**
+ * Adds chunk to the bin with the provided number in the current
+ * reference sequence, creating the bin if necessary. The chunk is
+ * merged into the previous chunk of the bin if they are adjacent.
+ */
+static void vcfidx_builder_add_chunk(VCFIdxBuilder *b, uint32_t bin_num,
+				     VCFIdxChunk *chunk) {
+  VCFIdxBin *bin;
+
+  bin = vcfidx_builder_get_bin(b, bin_num);
+
+  if(bin->n_chunk > 0 && bin->chunks[bin->n_chunk-1].end == chunk->beg) {
+    /* adjacent to previous chunk in this bin */
+    bin->chunks[bin->n_chunk-1].end = chunk->end;
+    return;
+  }
+  vcfidx_bin_append(bin, chunk);
+}
+
+
+
+static void vcfidx_builder_start_ref(VCFIdxBuilder *b,
+				     const char *chrom_name) {
+  VCFIndex *idx;
+  VCFIdxRef *ref;
+
+  idx = b->idx;
+
+  if(vcfidx_tid(idx, chrom_name) != -1) {
+    my_err("%s:%d: file is not sorted: records for chromosome '%s' are "
+	   "not contiguous", __FILE__, __LINE__, chrom_name);
+  }
+
+  if(idx->n_ref >= b->max_ref) {
+    b->max_ref *= 2;
+    idx->names = my_realloc(idx->names, sizeof(char *) * b->max_ref);
+    idx->refs = my_realloc(idx->refs, sizeof(VCFIdxRef) * b->max_ref);
+  }
+
+  b->tid = idx->n_ref;
+  idx->names[b->tid] = util_str_dup(chrom_name);
+  idx->n_ref += 1;
+
+  ref = &idx->refs[b->tid];
+  b->max_bin = VCFIDX_N_BIN_INIT;
+  ref->n_bin = 0;
+  ref->bins = my_new(VCFIdxBin, b->max_bin);
+  b->max_intv = VCFIDX_N_BIN_INIT;
+  ref->n_intv = 0;
+  ref->intv = my_new(uint64_t, b->max_intv);
+
+  b->last_beg = -1;
+  b->n_rec = 0;
+  b->has_save = FALSE;
+}
+
+
+
+/**
+ * Completes the bins and linear index of the current reference sequence
+ */
+static void vcfidx_builder_finish_ref(VCFIdxBuilder *b) {
+  VCFIndex *idx;
+  VCFIdxRef *ref;
+  VCFIdxBin *bin;
+  VCFIdxChunk meta;
+  uint32_t meta_bin;
+  long bot;
+  int i, level;
+
+  idx = b->idx;
+  ref = &idx->refs[b->tid];
+
+  if(b->has_save) {
+    vcfidx_builder_add_chunk(b, b->save_bin, &b->save);
+  }
+
+  /* windows before the first record get offset of first record,
+   * other empty windows get offset of the preceding window
+   */
+  for(i = 0; i < ref->n_intv && ref->intv[i] == UINT64_MAX; i++) {
+    ref->intv[i] = b->ref_off_beg;
+  }
+  for(; i < ref->n_intv; i++) {
+    if(ref->intv[i] == UINT64_MAX) {
+      ref->intv[i] = ref->intv[i-1];
+    }
+  }
+
+  if(idx->is_csi) {
+    /* CSI bins store the linear index offset of their first window */
+    for(i = 0; i < ref->n_bin; i++) {
+      level = 0;
+      while(ref->bins[i].bin >= (uint32_t)vcfidx_bin_first(level + 1)) {
+	level += 1;
+      }
+      bot = ((long)(ref->bins[i].bin - vcfidx_bin_first(level))) <<
+	((idx->depth - level) * 3);
+      ref->bins[i].loffset = (bot < ref->n_intv) ? ref->intv[bot] :
+	b->ref_off_beg;
+    }
+    my_free(ref->intv);
+    ref->n_intv = 0;
+  }
+
+  /* pseudo-bin records the offsets spanned by this sequence
+   * and the number of records. These are not real chunks, so they
+   * must not be merged even if they happen to be adjacent.
+   */
+  meta_bin = vcfidx_bin_first(idx->depth + 1) + 1;
+  bin = vcfidx_builder_get_bin(b, meta_bin);
+  meta.beg = b->ref_off_beg;
+  meta.end = b->ref_off_end;
+  vcfidx_bin_append(bin, &meta);
+  meta.beg = b->n_rec;
+  meta.end = 0;
+  vcfidx_bin_append(bin, &meta);
+
+  /* reset bin lookup table for next sequence */
+  for(i = 0; i < ref->n_bin; i++) {
+    b->bin_slot[ref->bins[i].bin] = -1;
+  }
+
+  qsort(ref->bins, ref->n_bin, sizeof(VCFIdxBin), vcfidx_bin_cmp);
+}
+
+
+
+/**
+ * Adds a record covering the 0-based half-open interval [beg, end)
+ * on the provided chromosome, which is stored in the file between
+ * virtual offsets off_beg and off_end. Records must be pushed in
+ * file order, and the file must be sorted. chrom_id is a distinct
+ * non-negative integer for each chromosome name (e.g. SNP.chrom_id),
+ * which saves comparing names, or -1 if it is unknown.
+ */
+void vcfidx_builder_push(VCFIdxBuilder *b, const char *chrom_name,
+			 int chrom_id, long beg, long end, uint64_t off_beg,
+			 uint64_t off_end) {
+  VCFIndex *idx;
+  VCFIdxRef *ref;
+  uint32_t bin_num;
+  long w, last_w;
+
+  idx = b->idx;
+
+  if(b->tid == -1 ||
+     ((chrom_id >= 0 || b->chrom_id >= 0) ? chrom_id != b->chrom_id :
+      strcmp(chrom_name, idx->names[b->tid]) != 0)) {
+    if(b->tid != -1) {
+      vcfidx_builder_finish_ref(b);
+    }
+    vcfidx_builder_start_ref(b, chrom_name);
+    b->chrom_id = chrom_id;
+  } else if(beg < b->last_beg) {
+    my_err("%s:%d: file is not sorted: position %ld on chromosome %s "
+	   "comes after position %ld", __FILE__, __LINE__, beg + 1,
+	   chrom_name, b->last_beg + 1);
+  }
+  b->last_beg = beg;
+  ref = &idx->refs[b->tid];
+
+  if(end <= beg) {
+    end = beg + 1;
+  }
+  if(end > (1L << (idx->min_shift + idx->depth * 3))) {
+    my_err("%s:%d: position %ld on chromosome %s is too large for %s "
+	   "index%s", __FILE__, __LINE__, end, chrom_name,
+	   idx->is_csi ? "CSI" : "TBI",
+	   idx->is_csi ? "" : ", use a CSI index instead");
+  }
+
+  if(b->n_rec == 0) {
+    b->ref_off_beg = off_beg;
+  }
+  b->ref_off_end = off_end;
+  b->n_rec += 1;
+
+  /* consecutive records in the same bin share a chunk */
+  bin_num = vcfidx_reg2bin(beg, end, idx->min_shift, idx->depth);
+  if(b->has_save && b->save_bin == bin_num) {
+    b->save.end = off_end;
+  } else {
+    if(b->has_save) {
+      vcfidx_builder_add_chunk(b, b->save_bin, &b->save);
+    }
+    b->has_save = TRUE;
+    b->save_bin = bin_num;
+    b->save.beg = off_beg;
+    b->save.end = off_end;
+  }
+
+  /* record offset of first record that overlaps each window */
+  last_w = (end - 1) >> idx->min_shift;
+  if(last_w >= b->max_intv) {
+    while(last_w >= b->max_intv) {
+      b->max_intv *= 2;
+    }
+    ref->intv = my_realloc(ref->intv, sizeof(uint64_t) * b->max_intv);
+  }
+  while(ref->n_intv <= last_w) {
+    ref->intv[ref->n_intv] = UINT64_MAX;
+    ref->n_intv += 1;
+  }
+  for(w = beg >> idx->min_shift; w <= last_w; w++) {
+    if(ref->intv[w] == UINT64_MAX) {
+      ref->intv[w] = off_beg;
+    }
+  }
+}
+
+
+
+/**
+ * Completes the index and frees the builder.
+ */
+VCFIndex *vcfidx_builder_finish(VCFIdxBuilder *b) {
+  VCFIndex *idx;
+
+  if(b->tid != -1) {
+    vcfidx_builder_finish_ref(b);
+  }
+
+  idx = b->idx;
+  my_free(b->bin_slot);
+  my_free(b);
+
+  return idx;
+}
+
+
+
+/**
+ * Writes the index to a BGZF-compressed file with the provided path,
+ * in tabix or CSI format.
+ */
+void vcfidx_write(VCFIndex *idx, const char *idx_path) {
+  BGZFWriter *w;
+  VCFIdxRef *ref;
+  VCFIdxBin *bin;
+  int32_t conf[7], n_ref, min_shift, depth, l_aux, n;
+  uint64_t n_no_coor;
+  int i, j;
+
+  w = bgzf_writer_open(idx_path, Z_DEFAULT_COMPRESSION, 0);
+
+  conf[0] = idx->format;
+  conf[1] = idx->col_seq;
+  conf[2] = idx->col_beg;
+  conf[3] = idx->col_end;
+  conf[4] = idx->meta;
+  conf[5] = idx->skip;
+  conf[6] = 0;
+  for(i = 0; i < idx->n_ref; i++) {
+    conf[6] += strlen(idx->names[i]) + 1;
+  }
+  n_ref = idx->n_ref;
+
+  if(idx->is_csi) {
+    bgzf_write(w, "CSI\1", 4);
+    min_shift = idx->min_shift;
+    depth = idx->depth;
+    l_aux = sizeof(conf) + conf[6];
+    bgzf_write(w, &min_shift, sizeof(min_shift));
+    bgzf_write(w, &depth, sizeof(depth));
+    bgzf_write(w, &l_aux, sizeof(l_aux));
+  } else {
+    bgzf_write(w, "TBI\1", 4);
+    bgzf_write(w, &n_ref, sizeof(n_ref));
+  }
+
+  /* tabix configuration and sequence names */
+  bgzf_write(w, conf, sizeof(conf));
+  for(i = 0; i < idx->n_ref; i++) {
+    bgzf_write(w, idx->names[i], strlen(idx->names[i]) + 1);
+  }
+
+  if(idx->is_csi) {
+    bgzf_write(w, &n_ref, sizeof(n_ref));
+  }
+
+  for(i = 0; i < idx->n_ref; i++) {
+    ref = &idx->refs[i];
+    n = ref->n_bin;
+    bgzf_write(w, &n, sizeof(n));
+
+    for(j = 0; j < ref->n_bin; j++) {
+      bin = &ref->bins[j];
+      bgzf_write(w, &bin->bin, sizeof(bin->bin));
+      if(idx->is_csi) {
+	bgzf_write(w, &bin->loffset, sizeof(bin->loffset));
+      }
+      n = bin->n_chunk;
+      bgzf_write(w, &n, sizeof(n));
+      bgzf_write(w, bin->chunks, sizeof(VCFIdxChunk) * bin->n_chunk);
+    }
+
+    if(!idx->is_csi) {
+      n = ref->n_intv;
+      bgzf_write(w, &n, sizeof(n));
+      bgzf_write(w, ref->intv, sizeof(uint64_t) * ref->n_intv);
+    }
+  }
+
+  /* number of records without coordinates */
+  n_no_coor = 0;
+  bgzf_write(w, &n_no_coor, sizeof(n_no_coor));
+
+  bgzf_writer_close(w);
+}
@@ -0,0 +1,122 @@
+#ifndef __VCFIDX_H__
+#define __VCFIDX_H__
+
+#include <stdint.h>
+
+/* binning scheme parameters used by tabix (.tbi) indexes */
+#define VCFIDX_TBI_MIN_SHIFT 14
+#define VCFIDX_TBI_DEPTH 5
+
+/* default min_shift for CSI indexes */
+#define VCFIDX_CSI_MIN_SHIFT 14
+
+/* tabix preset for VCF files */
+#define VCFIDX_TBX_VCF 2
+
+/* initial number of reference sequences and bins when building index */
+#define VCFIDX_N_REF_INIT 32
+#define VCFIDX_N_BIN_INIT 1024
+
+
+/* range of BGZF virtual file offsets */
+typedef struct {
+  uint64_t beg;
+  uint64_t end;
+} VCFIdxChunk;
+
+
+typedef struct {
+  uint32_t bin;
+
+  /* smallest virtual offset of records in this bin (CSI only) */
+  uint64_t loffset;
+
+  int n_chunk;
+  VCFIdxChunk *chunks;
+} VCFIdxBin;
+
+
+/* index for a single reference sequence (chromosome) */
+typedef struct {
+  /* bins are sorted by bin number */
+  int n_bin;
+  VCFIdxBin *bins;
+
+  /* linear index (TBI only) */
+  int n_intv;
+  uint64_t *intv;
+} VCFIdxRef;
+
+
+/**
+ * Tabix (.tbi) or CSI (.csi) index of a BGZF-compressed VCF file
+ */
+typedef struct {
+  int is_csi;
+  int min_shift;
+  int depth;
+
+  /* tabix configuration */
+  int32_t format;
+  int32_t col_seq;
+  int32_t col_beg;
+  int32_t col_end;
+  int32_t meta;
+  int32_t skip;
+
+  int n_ref;
+  char **names;
+  VCFIdxRef *refs;
+} VCFIndex;
+
+
+/**
+ * Used to build an index from records that are pushed in the order
+ * that they appear in the file
+ */
+typedef struct {
+  VCFIndex *idx;
+  int max_ref;
+
+  /* index of current reference sequence, -1 before first record */
+  int tid;
+  /* chrom_id that was pushed with current reference sequence */
+  int chrom_id;
+  long last_beg;
+
+  /* maps bin number to position in current ref's bins array (or -1) */
+  int n_bin_slot;
+  int *bin_slot;
+  int max_bin;
+  int max_intv;
+
+  /* range of virtual offsets and number of records in current ref */
+  uint64_t ref_off_beg;
+  uint64_t ref_off_end;
+  uint64_t n_rec;
+
+  /* chunk that is extended while consecutive records fall in same bin */
+  int has_save;
+  uint32_t save_bin;
+  VCFIdxChunk save;
+} VCFIdxBuilder;
+
+
+
+VCFIndex *vcfidx_load(const char *vcf_path);
+VCFIndex *vcfidx_read_file(const char *idx_path);
+void vcfidx_free(VCFIndex *idx);
+
+int vcfidx_tid(VCFIndex *idx, const char *chrom_name);
+VCFIdxChunk *vcfidx_query(VCFIndex *idx, int tid, long beg, long end,
+			  int *n_chunk);
+
+VCFIdxBuilder *vcfidx_builder_new(int is_csi, int min_shift, long max_len);
+void vcfidx_builder_push(VCFIdxBuilder *b, const char *chrom_name,
+			 int chrom_id, long beg, long end, uint64_t off_beg,
+			 uint64_t off_end);
+VCFIndex *vcfidx_builder_finish(VCFIdxBuilder *b);
+
+void vcfidx_write(VCFIndex *idx, const char *idx_path);
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vcf.h"
+#include "vcfidx.h"
+#include "reader.h"
+#include "bgzf.h"
+#include "snp.h"
+#include "util.h"
+#include "memutil.h"
+
+
+
+void usage(char **argv) {
+  fprintf(stderr, "\nusage: %s [OPTIONS] VCF.gz\n"
+	  "\n"
+	  "Description:\n"
+	  "  This program writes a tabix index (VCF.gz.tbi) for a sorted,\n"
+	  "  bgzip-compressed VCF file.\n"
+	  "\n"
+	  "Options:\n"
+	  "  --csi        write a CSI index (VCF.gz.csi) instead of a tabix\n"
+	  "               index. CSI indexes are needed for chromosomes\n"
+	  "               longer than 2^29 bp.\n"
+	  "  --min-shift N\n"
+	  "               size of smallest bins in CSI index is 2^N bp\n"
+	  "               (default %d)\n"
+	  "  --threads N  number of threads used to decompress VCF.gz\n"
+	  "               (default is the number of processors)\n"
+	  "  --force      overwrite existing index file\n"
+	  "\n", argv[0], VCFIDX_CSI_MIN_SHIFT);
+}
+
+
+
+/**
+ * Builds index by streaming the VCF once through the VCF parser and
+ * recording the virtual offsets of each record.
+ */
+VCFIndex *build_index(const char *vcf_path, int is_csi, int min_shift,
+		      int n_threads) {
+  Reader *rd;
+  VCFInfo *vcf_info;
+  VCFIdxBuilder *builder;
+  SNP snp;
+  uint64_t off_beg, off_end;
+  long i, max_len, n_rec;
+
+  rd = reader_open(vcf_path, n_threads);
+  vcf_info = vcf_info_new();
+  vcf_read_header(rd, vcf_info);
+
+  max_len = 0;
+  for(i = 0; i < vcf_info->n_chrom; i++) {
+    if(vcf_info->chrom[i].len > max_len) {
+      max_len = vcf_info->chrom[i].len;
+    }
+  }
+  builder = vcfidx_builder_new(is_csi, min_shift, max_len);
+
+  /* only fixed fields are needed, do not parse genotypes. Fixed
+   * columns are copied (the default), so chrom_name is terminated
+   */
+  snp_init(&snp);
+
+  n_rec = 0;
+  while(TRUE) {
+    off_beg = reader_tell(rd);
+    if(vcf_read_line(rd, vcf_info, &snp) == -1) {
+      break;
+    }
+    off_end = reader_tell(rd);
+
+    vcfidx_builder_push(builder, snp.chrom_name.str, snp.chrom_id,
+			snp.pos - 1, vcf_record_end(vcf_info, &snp),
+			off_beg, off_end);
+    n_rec += 1;
+  }
+
+  fprintf(stderr, "indexed %ld records\n", n_rec);
+
+  snp_free_strs(&snp);
+  vcf_info_free(vcf_info);
+  reader_free(rd);
+
+  return vcfidx_builder_finish(builder);
+}
+
+
+
+int main(int argc, char **argv) {
+  int c, is_csi, min_shift, n_threads, force;
+  char *vcf_path, *idx_path;
+  VCFIndex *idx;
+
+  static struct option loptions[] = {
+    {"csi", no_argument, NULL, 'c'},
+    {"min-shift", required_argument, NULL, 'm'},
+    {"threads", required_argument, NULL, 't'},
+    {"force", no_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  is_csi = FALSE;
+  min_shift = VCFIDX_CSI_MIN_SHIFT;
+  n_threads = bgzf_default_threads();
+  force = FALSE;
+
+  while((c = getopt_long(argc, argv, "cm:t:fh", loptions, NULL)) != -1) {
+    switch(c) {
+    case 'c':
+      is_csi = TRUE;
+      break;
+    case 'm':
+      min_shift = util_parse_long(optarg);
+      is_csi = TRUE;
+      break;
+    case 't':
+      n_threads = util_parse_long(optarg);
+      break;
+    case 'f':
+      force = TRUE;
+      break;
+    case 'h':
+      usage(argv);
+      exit(0);
+    default:
+      usage(argv);
+      exit(255);
+    }
+  }
+
+  if(argc - optind != 1) {
+    usage(argv);
+    exit(255);
+  }
+  vcf_path = argv[optind];
+
+  if(!bgzf_is_bgzf(vcf_path)) {
+    my_err("%s:%d: file '%s' is not BGZF compressed. Only files "
+	   "compressed with bgzip can be indexed.", __FILE__, __LINE__,
+	   vcf_path);
+  }
+
+  idx_path = util_str_concat(vcf_path, is_csi ? ".csi" : ".tbi", NULL);
+  if(!force && util_file_exists(idx_path)) {
+    my_err("%s:%d: index file '%s' already exists, use --force to "
+	   "overwrite it", __FILE__, __LINE__, idx_path);
+  }
+
+  idx = build_index(vcf_path, is_csi, min_shift, n_threads);
+  vcfidx_write(idx, idx_path);
+  fprintf(stderr, "wrote index to %s\n", idx_path);
+
+  vcfidx_free(idx);
+  my_free(idx_path);
+
+  return 0;
+}
@@ -7,84 +7,195 @@
 
 #include "vcf.h"
 #include "snp.h"
+#include "reader.h"
+#include "bgzf.h"
+#include "vcfidx.h"
+#include "prefetch.h"
+#include "vcfpar.h"
+#include "vcfcache.h"
+#include "writer.h"
 #include "util.h"
 #include "memutil.h"
 
+/* number of records that are read at once from each input by default */
+#define DEFAULT_BATCH_SIZE 64
+
+/* decimal places of genotype probabilities and dosages in output */
+#define OUT_PROB_DEC 3
+
+/* maximum length of a sample column in output, e.g. "\t0|1:0.25,0.5,0.25" */
+#define OUT_MAX_SAMPLE_LEN (8 + 3 * (WRITER_MAX_NUM_LEN + 1))
+
 typedef struct  {
-  gzFile gzf;
+  Reader *rd;
   Chromosome *cur_chrom;
   VCFInfo *vcf;
+
+  /* chrom_map[i] is index in merged chromosome table of chromosome i
+   * of vcf (i.e. of records with chrom_id i), or -1 if it is not in
+   * all files
+   */
+  int *chrom_map;
+  VCFRegion *region;
+  Prefetch *pf;
+  VCFPar *par;
+
+  /* records are read in batches if this is non-NULL, batch_idx is
+   * index of next record in batch
+   */
+  SNPBatch *batch;
+  long batch_idx;
+
+  /* records are read from cache instead of rd if this is non-NULL */
+  VCFCache *cache;
   char is_done;
-  SNP cur_snp;
+
+  /* cur_snp points to snp, or into prefetch ring, parsed chunk or
+   * batch if pf, par or batch is non-NULL
+   */
+  SNP snp;
+  SNP *cur_snp;
 } FileInfo;
 
 
 
 void usage(char **argv) {
-  fprintf(stderr, "\nusage: %s VCF1 VCF2 ... > MERGED_VCF\n"
+  fprintf(stderr, "\nusage: %s [OPTIONS] VCF1 VCF2 ... [> MERGED_VCF]\n"
 	  "\n"
 	  "Description:\n"
 	  "  This program merges VCF files. Input VCF files must be sorted\n"
-	  "\n", argv[0]);
+	  "  Inputs may also be binary caches written by vcf2cache.\n"
+	  "  Records with genotypes that have alleles other than 0 and 1\n"
+	  "  (e.g. at multi-allelic sites) are skipped when genotypes (GT)\n"
+	  "  are merged.\n"
+	  "\n"
+	  "Options:\n"
+	  "  --output FILE\n"
+	  "               write merged VCF to FILE instead of stdout. If\n"
+	  "               FILE ends with .gz it is BGZF-compressed, so that\n"
+	  "               it can be indexed by vcfindex.\n"
+	  "  --threads N  total number of threads used to decompress\n"
+	  "               BGZF-compressed inputs. Threads are divided\n"
+	  "               evenly between input files. The same number of\n"
+	  "               threads is used to compress output. Default is\n"
+	  "               the number of processors.\n"
+	  "  --region CHR:START-END\n"
+	  "               only merge records that overlap this region.\n"
+	  "               Input files must be bgzipped and have tabix\n"
+	  "               (.tbi) or CSI (.csi) indexes.\n"
+	  "  --prefetch N read and parse up to N records ahead for each\n"
+	  "               input on a separate thread per input. Default is\n"
+	  "               0, which reads all inputs on the main thread.\n"
+	  "  --parse-threads N\n"
+	  "               parse each input on N threads, which each parse\n"
+	  "               a chunk of consecutive records. Cannot be used\n"
+	  "               with --region or --prefetch. Default is 0, which\n"
+	  "               parses on the main thread.\n"
+	  "  --batch N    read records from each input in batches of N\n"
+	  "               (default %d). 0 reads one record at a time.\n"
+	  "  --geno-prob FIELD\n"
+	  "               FORMAT field that genotype probabilities are\n"
+	  "               read from: GL (log10 likelihoods), PL (phred-\n"
+	  "               scaled likelihoods), GP (posterior probabilities)\n"
+	  "               or auto (default), which uses the first of GL,\n"
+	  "               PL, GP that is present in each record.\n"
+	  "  --dosage TYPE\n"
+	  "               read dosages (DS) instead of genotype\n"
+	  "               probabilities, and store them as TYPE: float,\n"
+	  "               half (16 bit float) or uint8 (dosage quantized\n"
+	  "               to steps of 1/%d). Default is none.\n"
+	  "  --samples NAME1,NAME2,...\n"
+	  "               only read genotypes of these samples. Each input\n"
+	  "               keeps the listed samples that it has, and other\n"
+	  "               sample columns are skipped without being parsed.\n"
+	  "  --samples-file FILE\n"
+	  "               like --samples, but read sample names from FILE,\n"
+	  "               which has one name per line\n"
+	  "\n", argv[0], DEFAULT_BATCH_SIZE, VCF_DOSAGE_UINT8_SCALE);
 }
 
 
 
 
 /**
- * Find subset of chromosomes that are present in all VCFs
+ * Find subset of chromosomes that are present in all VCFs, in the
+ * order they are listed in the first VCF. Sets *chrom_dict to a
+ * dictionary of the names of the returned chromosomes, in which the
+ * ID of each chromosome is its index in the returned table.
  */
-Chromosome *chrom_table_intersect(FileInfo *f_info, int n_vcf, int *n_intersect) {
-  int i, j, k, n_chrom;
-  int *counts;
-  Chromosome *intersect;
+Chromosome *chrom_table_intersect(FileInfo *f_info, int n_vcf, int *n_intersect,
+				  ChromDict **chrom_dict) {
+  int i, j, k, id, n_first;
+  int *counts, *last_vcf, *first_idx;
+  Chromosome *intersect, *chrom;
+  ChromDict *first_dict;
 
   if(n_vcf < 1) {
     my_err("expected at least 1 vcf");
   }
 
-  counts = my_malloc(sizeof(int) * f_info[0].vcf->n_chrom);
-  for(i = 0; i < f_info[0].vcf->n_chrom; i++) {
-    counts[i] = 1;
+  /* intern chromosome names of first VCF */
+  first_dict = chrom_dict_new();
+  n_first = f_info[0].vcf->n_chrom;
+  first_idx = my_new(int, n_first);
+  for(i = 0; i < n_first; i++) {
+    chrom = &f_info[0].vcf->chrom[i];
+    id = chrom_dict_add(first_dict, chrom->name, strlen(chrom->name));
+    if(id == first_dict->n - 1) {
+      first_idx[id] = i;
+    }
   }
 
-  *n_intersect = 0;
+  counts = my_new(int, first_dict->n);
+  last_vcf = my_new(int, first_dict->n);
+  for(i = 0; i < first_dict->n; i++) {
+    counts[i] = 1;
+    last_vcf[i] = 0;
+  }
 
   /* count how many other VCFs each chrom occurs in */
-  for(i = 0; i < f_info[0].vcf->n_chrom; i++) {
-    for(j = 1; j < n_vcf; j++) {
-      for(k = 0; k < f_info[j].vcf->n_chrom; k++) {
-	if(strcmp(f_info[0].vcf->chrom[i].name,
-		  f_info[j].vcf->chrom[k].name) == 0) {
-	  counts[i] += 1;
-	  if(counts[i] == n_vcf) {
-	    /* this chrom found in all VCFs */
-	    *n_intersect += 1;
-	  }
-	  break;
-	}
+  for(j = 1; j < n_vcf; j++) {
+    for(k = 0; k < f_info[j].vcf->n_chrom; k++) {
+      chrom = &f_info[j].vcf->chrom[k];
+      id = chrom_dict_lookup(first_dict, chrom->name, strlen(chrom->name));
+      if(id >= 0 && last_vcf[id] != j) {
+	/* only count each VCF once, even if chrom is repeated */
+	last_vcf[id] = j;
+	counts[id] += 1;
       }
     }
   }
 
+  *n_intersect = 0;
+  for(i = 0; i < first_dict->n; i++) {
+    if(counts[i] == n_vcf) {
+      *n_intersect += 1;
+    }
+  }
+
   intersect = my_malloc(sizeof(Chromosome) * *n_intersect);
+  *chrom_dict = chrom_dict_new();
   j = 0;
-  for(i = 0; i < f_info[0].vcf->n_chrom; i++) {
+  for(i = 0; i < first_dict->n; i++) {
+    chrom = &f_info[0].vcf->chrom[first_idx[i]];
     if(counts[i] == n_vcf) {
       /* copy chrom found in all VCFs */
-      intersect[j].id = j;
-      intersect[j].name = util_str_dup(f_info[0].vcf->chrom[i].name);
-      intersect[j].assembly = util_str_dup(f_info[0].vcf->chrom[i].assembly);
-      intersect[j].len = f_info[0].vcf->chrom[i].len;
+      intersect[j].id = chrom_dict_add(*chrom_dict, chrom->name,
+				       strlen(chrom->name));
+      intersect[j].name = util_str_dup(chrom->name);
+      intersect[j].assembly = util_str_dup(chrom->assembly);
+      intersect[j].len = chrom->len;
       j += 1;
     } else {
       fprintf(stderr, "skipping chromosome %s because only found "
-	      "in %d/%d VCFs\n", f_info[0].vcf->chrom[i].name, counts[i], n_vcf);
+	      "in %d/%d VCFs\n", chrom->name, counts[i], n_vcf);
     }
   }
 
-
   my_free(counts);
+  my_free(last_vcf);
+  my_free(first_idx);
+  chrom_dict_free(first_dict);
   
   return intersect;
 }
@@ -92,71 +203,281 @@ Chromosome *chrom_table_intersect(FileInfo *f_info, int n_vcf, int *n_intersect)
 
 
 
-FileInfo *init_file_info(int n_vcf, char **vcf_filenames) {
+FileInfo *init_file_info(int n_vcf, char **vcf_filenames, int n_threads,
+			 const char *region_str, int n_prefetch,
+			 int n_parse_threads, int n_batch, int prob_src,
+			 int dosage_type, char **sample_names,
+			 long n_sample_names) {
   FileInfo *f_info;
-  int i, ret;
+  VCFIndex *idx;
+  int i, file_threads, arrays;
+  char *sample_found;
+  long j;
 
   f_info = my_malloc(sizeof(FileInfo) * n_vcf);
 
+  /* each input only keeps the selected samples that it has, but
+   * every selected sample must be in at least one input
+   */
+  sample_found = (sample_names) ? my_new0(char, n_sample_names) : NULL;
+
+  /* split decompression threads between files. If there are
+   * fewer threads than files, each file is inflated by the main thread
+   */
+  file_threads = n_threads / n_vcf;
+
   for(i = 0; i < n_vcf; i++) {
-    f_info[i].vcf = vcf_info_new();
-    fprintf(stderr, "reading VCF header from %s\n", vcf_filenames[i]);
-    f_info[i].gzf = util_must_gzopen(vcf_filenames[i], "rb");
-    vcf_read_header(f_info[i].gzf, f_info[i].vcf);
-    fprintf(stderr, "  VCF header lines: %ld\n", f_info[i].vcf->n_header_lines);
+    if(vcfcache_is_cache(vcf_filenames[i])) {
+      /* binary cache that was written by vcf2cache */
+      fprintf(stderr, "reading VCF cache %s\n", vcf_filenames[i]);
+      if(region_str) {
+	my_err("%s:%d: --region cannot be used with cache file '%s'",
+	       __FILE__, __LINE__, vcf_filenames[i]);
+      }
+      if(dosage_type != VCF_DOSAGE_NONE) {
+	my_err("%s:%d: cache file '%s' does not contain dosages",
+	       __FILE__, __LINE__, vcf_filenames[i]);
+      }
+      f_info[i].cache = vcfcache_open(vcf_filenames[i]);
+      f_info[i].rd = NULL;
+      f_info[i].vcf = f_info[i].cache->vcf;
+    } else {
+      f_info[i].cache = NULL;
+      f_info[i].vcf = vcf_info_new();
+      vcf_set_prob_source(f_info[i].vcf, prob_src);
+      vcf_set_dosage_type(f_info[i].vcf, dosage_type);
+      fprintf(stderr, "reading VCF header from %s\n", vcf_filenames[i]);
+      f_info[i].rd = reader_open(vcf_filenames[i], file_threads);
+      vcf_read_header(f_info[i].rd, f_info[i].vcf);
+      fprintf(stderr, "  VCF header lines: %ld\n",
+	      f_info[i].vcf->n_header_lines);
+    }
+
+    if(sample_names) {
+      /* genotype arrays below are sized to selected samples */
+      if(vcf_select_samples(f_info[i].vcf, sample_names, n_sample_names,
+			    sample_found) == 0) {
+	my_err("%s:%d: none of the selected samples are in '%s'",
+	       __FILE__, __LINE__, vcf_filenames[i]);
+      }
+      fprintf(stderr, "  selected %ld of %ld samples\n",
+	      f_info[i].vcf->n_samples, f_info[i].vcf->n_file_samples);
+    }
+
+    if(region_str) {
+      idx = vcfidx_load(vcf_filenames[i]);
+      f_info[i].region = vcf_region_new(idx, region_str);
+      vcfidx_free(idx);
+    } else {
+      f_info[i].region = NULL;
+    }
 
     f_info[i].is_done = FALSE;
 
-    /* initialize memory for current SNPs */
-    f_info[i].cur_snp.geno_probs =
-      my_malloc(sizeof(float) * f_info[i].vcf->n_geno_prob_col);
-    f_info[i].cur_snp.haplotypes =
-      my_malloc(sizeof(char) * f_info[i].vcf->n_haplo_col);
+    snp_init(&f_info[i].snp);
+    f_info[i].pf = NULL;
+    f_info[i].par = NULL;
+    f_info[i].batch = NULL;
+    f_info[i].batch_idx = 0;
+
+    if(n_prefetch > 0 && f_info[i].cache == NULL) {
+      /* SNPs are read into ring by producer thread */
+      f_info[i].pf = prefetch_new(f_info[i].rd, f_info[i].vcf,
+				  f_info[i].region, n_prefetch);
+    } else if(n_parse_threads > 0 && f_info[i].cache == NULL) {
+      /* SNPs are parsed into chunks by worker threads */
+      arrays = VCFPAR_HAPLOTYPES;
+      arrays |= (dosage_type == VCF_DOSAGE_NONE) ?
+	VCFPAR_GENO_PROBS : VCFPAR_DOSAGES;
+      f_info[i].par = vcfpar_new(f_info[i].rd, f_info[i].vcf,
+				 n_parse_threads, arrays);
+    } else if(n_batch > 0 && f_info[i].cache == NULL) {
+      /* SNPs are parsed into rows of batch */
+      arrays = VCF_BATCH_HAPLOTYPES;
+      arrays |= (dosage_type == VCF_DOSAGE_NONE) ?
+	VCF_BATCH_GENO_PROBS : VCF_BATCH_DOSAGES;
+      f_info[i].batch = vcf_batch_new(f_info[i].vcf, n_batch, arrays);
+    } else {
+      /* each SNP is written out before the next one is read from
+       * the same file, so fixed columns need not be copied
+       */
+      vcf_set_record_mode(f_info[i].vcf, VCF_RECORD_VIEW);
 
-    f_info[i].cur_snp.has_geno_probs = FALSE;
-    f_info[i].cur_snp.has_haplotypes = FALSE;
+      /* initialize memory for current SNPs, dosages are read
+       * instead of genotype probabilities if they were requested
+       */
+      if(dosage_type == VCF_DOSAGE_NONE) {
+	f_info[i].snp.geno_probs =
+	  my_malloc(sizeof(float) * f_info[i].vcf->n_geno_prob_col);
+      } else {
+	f_info[i].snp.dosages = my_malloc(vcf_dosage_size(dosage_type) *
+					  f_info[i].vcf->n_samples);
+      }
+      f_info[i].snp.haplotypes =
+	my_malloc(sizeof(char) * f_info[i].vcf->n_haplo_col);
+      f_info[i].snp.unphased =
+	my_malloc(SNP_UNPHASED_SIZE(f_info[i].vcf->n_samples));
+    }
+    f_info[i].cur_snp = &f_info[i].snp;
 
     f_info[i].cur_chrom = NULL;
+    f_info[i].chrom_map = NULL;
+  }
+
+  if(sample_found) {
+    for(j = 0; j < n_sample_names; j++) {
+      if(!sample_found[j]) {
+	my_err("%s:%d: sample '%s' is not in any of the input files",
+	       __FILE__, __LINE__, sample_names[j]);
+      }
+    }
+    my_free(sample_found);
   }
 
   return f_info;
 }
 
 
+
+/**
+ * Maps the chromosomes of each file to the merged chromosome table,
+ * whose names are in chrom_dict
+ */
+void set_chrom_maps(FileInfo *f_info, int n_vcf, ChromDict *chrom_dict) {
+  Chromosome *chrom;
+  int i;
+  long k;
+
+  for(i = 0; i < n_vcf; i++) {
+    f_info[i].chrom_map = my_new(int, f_info[i].vcf->n_chrom);
+    for(k = 0; k < f_info[i].vcf->n_chrom; k++) {
+      chrom = &f_info[i].vcf->chrom[k];
+      f_info[i].chrom_map[k] = chrom_dict_lookup(chrom_dict, chrom->name,
+						 strlen(chrom->name));
+    }
+  }
+}
+
+
 void free_file_info(FileInfo *f_info, int n) {
   int i;
   
   for(i = 0; i < n; i++) {
-    vcf_info_free(f_info[i].vcf);
-    
-    gzclose(f_info[i].gzf);
+    if(f_info[i].pf) {
+      /* stop producer thread before freeing reader */
+      prefetch_free(f_info[i].pf);
+    }
+    if(f_info[i].par) {
+      vcfpar_free(f_info[i].par);
+    }
+    if(f_info[i].batch) {
+      vcf_batch_free(f_info[i].batch);
+    }
+
+    if(f_info[i].cache) {
+      /* VCFInfo is owned by cache */
+      vcfcache_close(f_info[i].cache);
+    } else {
+      vcf_info_free(f_info[i].vcf);
+      reader_free(f_info[i].rd);
+    }
 
-    if(f_info[i].cur_snp.haplotypes) {
-      my_free(f_info[i].cur_snp.haplotypes);
+    if(f_info[i].region) {
+      vcf_region_free(f_info[i].region);
     }
-    if(f_info[i].cur_snp.geno_probs) {
-      my_free(f_info[i].cur_snp.geno_probs);
+    if(f_info[i].chrom_map) {
+      my_free(f_info[i].chrom_map);
     }
+
+    if(f_info[i].snp.haplotypes) {
+      my_free(f_info[i].snp.haplotypes);
+    }
+    if(f_info[i].snp.unphased) {
+      my_free(f_info[i].snp.unphased);
+    }
+    if(f_info[i].snp.geno_probs) {
+      my_free(f_info[i].snp.geno_probs);
+    }
+    if(f_info[i].snp.dosages) {
+      my_free(f_info[i].snp.dosages);
+    }
+    snp_free_strs(&f_info[i].snp);
   }
   my_free(f_info);
 }
 
 
 
-void set_cur_chrom(FileInfo *f_info, Chromosome *chrom_tab, int n_chrom) {
-  int i;
-  
-  if(f_info->cur_chrom != NULL) {
-    if(strcmp(f_info->cur_snp.chrom_name, f_info->cur_chrom->name) == 0) {
-      /* current chromosome matches name in SNP */
-      return;
+/**
+ * Reads next SNP from file (restricted to region if one was given).
+ * Returns 0 on success, -1 if there are no more SNPs.
+ */
+int read_snp(FileInfo *f_info) {
+  if(f_info->cache) {
+    return vcfcache_read(f_info->cache, f_info->cur_snp);
+  }
+  if(f_info->pf) {
+    f_info->cur_snp = prefetch_next(f_info->pf);
+    return (f_info->cur_snp == NULL) ? -1 : 0;
+  }
+  if(f_info->par) {
+    f_info->cur_snp = vcfpar_next(f_info->par);
+    return (f_info->cur_snp == NULL) ? -1 : 0;
+  }
+  if(f_info->batch) {
+    if(f_info->batch_idx >= f_info->batch->n) {
+      /* read next batch of records */
+      if(vcf_read_batch(f_info->rd, f_info->vcf, f_info->region,
+			f_info->batch, f_info->batch->max_n) == 0) {
+	return -1;
+      }
+      f_info->batch_idx = 0;
     }
+    f_info->cur_snp = vcf_batch_snp(f_info->batch, f_info->batch_idx);
+    f_info->batch_idx += 1;
+    return 0;
   }
-  for(i = 0; i < n_chrom; i++) {
-    if(strcmp(f_info->cur_snp.chrom_name, chrom_tab[i].name) == 0) {
-      f_info->cur_chrom = &chrom_tab[i];
+  if(f_info->region) {
+    return vcf_read_region_line(f_info->rd, f_info->vcf, f_info->region,
+				f_info->cur_snp);
+  }
+  return vcf_read_line(f_info->rd, f_info->vcf, f_info->cur_snp);
+}
+
+
+
+/**
+ * Sets cur_chrom to the entry of chrom_tab for the chromosome of the
+ * current SNP, or NULL if it is not in chrom_tab. The parser has
+ * already resolved the chromosome name to an index, so no string
+ * comparisons are needed.
+ */
+void set_cur_chrom(FileInfo *f_info, Chromosome *chrom_tab) {
+  int id;
+
+  id = f_info->cur_snp->chrom_id;
+  if(id >= 0) {
+    id = f_info->chrom_map[id];
+  }
+  f_info->cur_chrom = (id >= 0) ? &chrom_tab[id] : NULL;
+}
+
+
+
+/**
+ * Reads the next SNP from file that is on one of the chromosomes in
+ * chrom_tab. SNPs on other chromosomes are skipped and counted in
+ * *n_skip. Returns 0 on success or -1 at EOF.
+ */
+int read_merge_snp(FileInfo *f_info, Chromosome *chrom_tab, long *n_skip) {
+  while(read_snp(f_info) != -1) {
+    set_cur_chrom(f_info, chrom_tab);
+    if(f_info->cur_chrom != NULL) {
+      return 0;
     }
+    *n_skip += 1;
   }
+  return -1;
 }
 
 
@@ -173,10 +494,10 @@ int f_cmp(FileInfo *f1, FileInfo *f2) {
   if(f1->cur_chrom->id > f2->cur_chrom->id) {
     return 1;
   }
-  if(f1->cur_snp.pos < f2->cur_snp.pos) {
+  if(f1->cur_snp->pos < f2->cur_snp->pos) {
     return -1;
   }
-  if(f1->cur_snp.pos > f2->cur_snp.pos) {
+  if(f1->cur_snp->pos > f2->cur_snp->pos) {
     return 1;
   }
   return 0;
@@ -184,112 +505,359 @@ int f_cmp(FileInfo *f1, FileInfo *f2) {
 
 
 /**
- * Finds file(s) with current SNP(s) with lowest coordinates.
- * Sets values in is_lowest and lowest arrays:
- * - is_lowest is of length n_vcf and has TRUE or FALSE flags.
+ * Binary min-heap of files that are not yet done, ordered by the
+ * (chrom, pos) of their current SNPs.
+ */
+typedef struct {
+  int n;
+  int *idx;
+} FileHeap;
+
+
+FileHeap *file_heap_new(int n_vcf) {
+  FileHeap *heap;
+
+  heap = my_new(FileHeap, 1);
+  heap->n = 0;
+  heap->idx = my_new(int, n_vcf);
+
+  return heap;
+}
+
+
+void file_heap_free(FileHeap *heap) {
+  my_free(heap->idx);
+  my_free(heap);
+}
+
+
+/**
+ * Adds file with index i in f_info array to heap
+ */
+void file_heap_push(FileHeap *heap, FileInfo *f_info, int i) {
+  int child, parent;
+
+  child = heap->n;
+  heap->n += 1;
+
+  /* move up until parent is not greater */
+  while(child > 0) {
+    parent = (child - 1) / 2;
+    if(f_cmp(&f_info[heap->idx[parent]], &f_info[i]) <= 0) {
+      break;
+    }
+    heap->idx[child] = heap->idx[parent];
+    child = parent;
+  }
+  heap->idx[child] = i;
+}
+
+
+/**
+ * Removes file with lowest SNP from heap and returns its index in
+ * f_info array.
+ */
+int file_heap_pop(FileHeap *heap, FileInfo *f_info) {
+  int top, last, parent, child;
+
+  top = heap->idx[0];
+  heap->n -= 1;
+  if(heap->n == 0) {
+    return top;
+  }
+
+  /* move last element down from root until children are not lower */
+  last = heap->idx[heap->n];
+  parent = 0;
+  while(TRUE) {
+    child = parent * 2 + 1;
+    if(child >= heap->n) {
+      break;
+    }
+    if(child + 1 < heap->n &&
+       f_cmp(&f_info[heap->idx[child + 1]], &f_info[heap->idx[child]]) < 0) {
+      child += 1;
+    }
+    if(f_cmp(&f_info[last], &f_info[heap->idx[child]]) <= 0) {
+      break;
+    }
+    heap->idx[parent] = heap->idx[child];
+    parent = child;
+  }
+  heap->idx[parent] = last;
+
+  return top;
+}
+
+
+
+/**
+ * Finds file(s) with current SNP(s) with lowest coordinates by
+ * removing them from the heap. Sets values in is_lowest and lowest
+ * arrays:
+ * - is_lowest is of length n_vcf and has TRUE or FALSE flags. Flags
+ *   should be reset to FALSE by caller after files have been advanced.
  * - lowest has *n_lowest values which are indices pointing
  *   to elements in f_info array.
  */
-void find_lowest(FileInfo *f_info, int n_vcf,
+void find_lowest(FileInfo *f_info, FileHeap *heap,
 		 int *is_lowest, int *lowest, int *n_lowest) {
-  int i, j;
-  FileInfo *cur_lowest;
+  int i;
 
-  *n_lowest = 0;
-  
-  for(i = 0; i < n_vcf; i++) {
-    is_lowest[i] = FALSE;
+  lowest[0] = file_heap_pop(heap, f_info);
+  *n_lowest = 1;
+
+  while(heap->n > 0 &&
+	f_cmp(&f_info[heap->idx[0]], &f_info[lowest[0]]) == 0) {
+    /* another SNP that matches lowest */
+    lowest[*n_lowest] = file_heap_pop(heap, f_info);
+    *n_lowest += 1;
+  }
+
+  for(i = 0; i < *n_lowest; i++) {
+    is_lowest[lowest[i]] = TRUE;
+  }
+}
+
+
+/**
+ * Returns the FORMAT string of output records, or NULL if no
+ * genotype fields are written
+ */
+const char *get_format_str(int write_geno_probs, int write_haplotypes,
+			   int write_dosages) {
+  if(write_dosages && write_haplotypes) {
+    return "GT:DS";
+  }
+  else if(write_dosages) {
+    return "DS";
   }
+  else if(write_geno_probs && write_haplotypes) {
+    return "GT:GP";
+  }
+  else if(write_haplotypes) {
+    return "GT";
+  }
+  else if(write_geno_probs) {
+    return "GP";
+  }
+  return NULL;
+}
+
+
+
+/**
+ * Writes VCF header with the chromosomes that are merged and the
+ * sample names of all inputs, in the order the inputs were given
+ */
+void write_header(Writer *w, FileInfo *f_info, int n_vcf,
+		  Chromosome *chrom_tab, int n_chrom, const char *format_str) {
+  VCFInfo *vcf;
+  long j;
+  int i;
+
+  writer_puts(w, "##fileformat=VCFv4.2\n");
+  writer_puts(w, "##source=vcfmerge\n");
+
+  for(i = 0; i < n_chrom; i++) {
+    writer_puts(w, "##contig=<ID=");
+    writer_puts(w, chrom_tab[i].name);
+    if(chrom_tab[i].assembly && chrom_tab[i].assembly[0] != '\0') {
+      writer_puts(w, ",assembly=");
+      writer_puts(w, chrom_tab[i].assembly);
+    }
+    if(chrom_tab[i].len > 0) {
+      writer_puts(w, ",length=");
+      writer_put_long(w, chrom_tab[i].len);
+    }
+    writer_puts(w, ">\n");
+  }
+
+  if(format_str && strstr(format_str, "GT")) {
+    writer_puts(w, "##FORMAT=<ID=GT,Number=1,Type=String,"
+		"Description=\"Genotype\">\n");
+  }
+  if(format_str && strstr(format_str, "GP")) {
+    writer_puts(w, "##FORMAT=<ID=GP,Number=G,Type=Float,"
+		"Description=\"Genotype probabilities\">\n");
+  }
+  if(format_str && strstr(format_str, "DS")) {
+    writer_puts(w, "##FORMAT=<ID=DS,Number=1,Type=Float,"
+		"Description=\"Alternate allele dosage\">\n");
+  }
+
+  writer_puts(w, "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO");
+  if(format_str == NULL) {
+    /* no genotype fields, so no sample columns */
+    writer_putc(w, '\n');
+    return;
+  }
+  writer_puts(w, "\tFORMAT");
+
   for(i = 0; i < n_vcf; i++) {
-    if(f_info[i].is_done) {
-      /* at end of this file */
-      continue;
-    }
-    if(*n_lowest == 0) {
-      /* first file that is not at end */
-      lowest[0] = i;
-      *n_lowest = 1;
-      cur_lowest = &f_info[i];
-    } else {
-      /* is this file's SNP lower than current lowest? */
-      int c = f_cmp(&f_info[i], cur_lowest);
-      if(c < 0) {
-	/* new lowest SNP */
-	cur_lowest = &f_info[i];
-	lowest[0] = i;
-	*n_lowest = 1;
-      } else if(c == 0) {
-	  /* another SNP that matches lowest */
-	  lowest[*n_lowest] = i;
-	  *n_lowest += 1;
+    vcf = f_info[i].vcf;
+    for(j = 0; j < vcf->n_file_samples; j++) {
+      if(vcf->sample_keep == NULL || vcf->sample_keep[j]) {
+	writer_putc(w, '\t');
+	writer_puts(w, vcf->sample_names[j]);
       }
     }
   }
+  writer_putc(w, '\n');
+}
 
-  for(i = 0; i < *n_lowest; i++) {
-    is_lowest[lowest[i]] = TRUE;
+
+
+/**
+ * Writes the sample columns of a file into dest, which must have
+ * room for OUT_MAX_SAMPLE_LEN characters per sample. Samples are
+ * written as missing if snp is NULL (the file has no record at this
+ * position). Returns the number of characters written.
+ */
+size_t write_samples(char *dest, VCFInfo *vcf, SNP *snp,
+		     int write_geno_probs, int write_haplotypes,
+		     int write_dosages) {
+  char *p, *haps;
+  float *probs;
+  long j;
+  int k;
+
+  p = dest;
+  for(j = 0; j < vcf->n_samples; j++) {
+    *p++ = '\t';
+
+    if(write_haplotypes) {
+      if(snp && snp->has_haplotypes) {
+	/* missing alleles are negative. Genotypes are only written as
+	 * phased if they were phased in the input
+	 */
+	haps = &snp->haplotypes[j*2];
+	*p++ = (haps[0] < 0) ? '.' : '0' + haps[0];
+	*p++ = (snp->unphased == NULL ||
+		SNP_UNPHASED_GET(snp->unphased, j)) ? '/' : '|';
+	*p++ = (haps[1] < 0) ? '.' : '0' + haps[1];
+      } else {
+	memcpy(p, "./.", 3);
+	p += 3;
+      }
+      if(write_geno_probs || write_dosages) {
+	*p++ = ':';
+      }
+    }
+
+    if(write_geno_probs) {
+      if(snp && snp->has_geno_probs) {
+	probs = &snp->geno_probs[j*3];
+	for(k = 0; k < 3; k++) {
+	  if(k > 0) {
+	    *p++ = ',';
+	  }
+	  p += writer_fmt_fixed(p, probs[k], OUT_PROB_DEC);
+	}
+      } else {
+	*p++ = '.';
+      }
+    }
+
+    if(write_dosages) {
+      if(snp && snp->has_dosages) {
+	p += writer_fmt_fixed(p, vcf_get_dosage(vcf->dosage_type,
+						snp->dosages, j),
+			      OUT_PROB_DEC);
+      } else {
+	*p++ = '.';
+      }
+    }
   }
+
+  return p - dest;
 }
 
 
-void write_output(FILE *f, FileInfo *f_info, int n_vcf, int *is_lowest,
-		  int *lowest, int write_geno_probs, int write_haplotypes) {
+
+/**
+ * Writes a merged record for the SNPs of the files with the lowest
+ * position, with the sample columns of every input. Samples of
+ * files that do not have a record at this position are missing.
+ */
+void write_output(Writer *w, FileInfo *f_info, int n_vcf, int *is_lowest,
+		  int *lowest, const char *format_str, int write_geno_probs,
+		  int write_haplotypes, int write_dosages) {
   SNP *s;
-  char *format_str, *filter_str;
-  int qual;
-  
+  char *p;
+  int i;
 
   /* TODO: BUILD NEW INFO field */
   /* TODO: NOT SURE WHAT TO DO ABOUT QUAL, FILTER */
   /* TODO: check that alleles match! */
 
-  if(write_geno_probs && write_haplotypes) {
-    format_str = "GL;GT";
-  }
-  else if(write_haplotypes) {
-    format_str = "GT";
-  }
-  else if(write_geno_probs) {
-    format_str = "GL";
-  }
-  
-  qual = 100;
-  filter_str = "PASS";
-  
   /* obtain SNP info from first of SNPs that is in group of lowest SNPs */
-  s = &f_info[lowest[0]].cur_snp;
-  fprintf(f, "%s\t%ld\t%s\t%s\t%s\t%d\t%s\t%s", s->chrom_name, s->pos, s->name,
-	  s->allele1, s->allele2, qual, filter_str, format_str);
+  s = f_info[lowest[0]].cur_snp;
+  writer_write(w, s->chrom_name.str, s->chrom_name.len);
+  writer_putc(w, '\t');
+  writer_put_long(w, s->pos);
+  writer_putc(w, '\t');
+  writer_write(w, s->name.str, s->name.len);
+  writer_putc(w, '\t');
+  writer_write(w, s->allele1.str, s->allele1.len);
+  writer_putc(w, '\t');
+  writer_write(w, s->allele2.str, s->allele2.len);
+  writer_puts(w, "\t100\tPASS\t.");
 
-  /* TODO: write out genotype information for every file... */
-  
-  fprintf(f, "\n");
-  
+  if(format_str) {
+    writer_putc(w, '\t');
+    writer_puts(w, format_str);
 
+    for(i = 0; i < n_vcf; i++) {
+      p = writer_reserve(w, f_info[i].vcf->n_samples * OUT_MAX_SAMPLE_LEN);
+      writer_commit(w, write_samples(p, f_info[i].vcf,
+				     is_lowest[i] ? f_info[i].cur_snp : NULL,
+				     write_geno_probs, write_haplotypes,
+				     write_dosages));
+    }
+  }
+
+  writer_putc(w, '\n');
 }
 
 
-void merge_vcf(int n_vcf, char **vcf_filenames) {
+void merge_vcf(int n_vcf, char **vcf_filenames, const char *out_path,
+	       int n_threads, const char *region_str, int n_prefetch,
+	       int n_parse_threads, int n_batch, int prob_src,
+	       int dosage_type, char **sample_names, long n_sample_names) {
   FileInfo *f_info;
-  int n_done, n_chrom, i, *is_lowest, *lowest, n_lowest;
-  int ret, use_geno_probs, use_haplotypes;
+  int n_done, n_chrom, i, j, *is_lowest, *lowest, n_lowest;
+  int ret, use_geno_probs, use_haplotypes, use_dosages;
+  const char *format_str;
   Chromosome *chrom_tab;
+  ChromDict *chrom_dict;
+  FileHeap *heap;
+  Writer *w;
+  long n_skip, n_other;
 
-  f_info = init_file_info(n_vcf, vcf_filenames);
+  f_info = init_file_info(n_vcf, vcf_filenames, n_threads, region_str,
+			  n_prefetch, n_parse_threads, n_batch, prob_src,
+			  dosage_type, sample_names, n_sample_names);
   
   /* find chromosomes that are present in ALL VCFs */
-  chrom_tab = chrom_table_intersect(f_info, n_vcf, &n_chrom);
+  chrom_tab = chrom_table_intersect(f_info, n_vcf, &n_chrom, &chrom_dict);
+  set_chrom_maps(f_info, n_vcf, chrom_dict);
+  chrom_dict_free(chrom_dict);
   n_done = 0;
-  is_lowest = my_malloc(sizeof(int) * n_vcf);
+  n_skip = 0;
+  n_other = 0;
+  is_lowest = my_malloc0(sizeof(int) * n_vcf);
   lowest = my_malloc(sizeof(int) * n_vcf);
+  heap = file_heap_new(n_vcf);
 
   /* only use genotypes and haplotypes if they are present in ALL files */
-  use_geno_probs = TRUE;
+  use_geno_probs = (dosage_type == VCF_DOSAGE_NONE);
   use_haplotypes = TRUE;
+  use_dosages = (dosage_type != VCF_DOSAGE_NONE);
   
   /* read first SNP from all files */
   for(i = 0; i < n_vcf; i++) {
-    ret = vcf_read_line(f_info[i].gzf, f_info[i].vcf, &f_info[i].cur_snp);
+    ret = read_merge_snp(&f_info[i], chrom_tab, &n_skip);
     if(ret == -1) {
       /* file is over */
       n_done += 1;
@@ -297,16 +865,22 @@ void merge_vcf(int n_vcf, char **vcf_filenames) {
       my_warn("file %s contains no SNPs\n", vcf_filenames[i]);
       f_info[i].cur_chrom = NULL;
     } else {
-      set_cur_chrom(&f_info[i], chrom_tab, n_chrom);
-
-      if(!f_info[i].cur_snp.has_geno_probs) {
-	if(use_geno_probs) {
-	  fprintf(stderr, "Not using genotype likelihoods (GL) because "
+      if(!f_info[i].cur_snp->has_dosages) {
+	if(use_dosages) {
+	  fprintf(stderr, "Not using dosages (DS) because "
 		  "not present in file %s\n", vcf_filenames[i]);
 	}
+	use_dosages = FALSE;
+      }
+      if(!f_info[i].cur_snp->has_geno_probs) {
+	if(use_geno_probs) {
+	  fprintf(stderr, "Not using genotype probabilities (%s) because "
+		  "not present in file %s\n", vcf_prob_source_name(prob_src),
+		  vcf_filenames[i]);
+	}
 	use_geno_probs = FALSE;
       }
-      if(!f_info[i].cur_snp.has_haplotypes) {
+      if(!f_info[i].cur_snp->has_haplotypes) {
 	if(use_haplotypes) {
 	  fprintf(stderr, "Not using genotypes (GT) because "
 		  "not present in file %s\n", vcf_filenames[i]);
@@ -316,30 +890,65 @@ void merge_vcf(int n_vcf, char **vcf_filenames) {
     }
   }
   
+  for(i = 0; i < n_vcf; i++) {
+    if(!f_info[i].is_done) {
+      file_heap_push(heap, f_info, i);
+    }
+  }
+  
+  format_str = get_format_str(use_geno_probs, use_haplotypes, use_dosages);
+  w = writer_open(out_path, n_threads);
+  write_header(w, f_info, n_vcf, chrom_tab, n_chrom, format_str);
+
   fprintf(stderr, "parsing files\n");
 
   while(n_done < n_vcf) {
     /* find SNP(s) with lowest (chrom, pos) */
-    find_lowest(f_info, n_vcf, is_lowest, lowest, &n_lowest);
+    find_lowest(f_info, heap, is_lowest, lowest, &n_lowest);
 
-    /* merge counts and write line for these SNPs */
-    write_output(stdout, f_info, n_vcf, is_lowest, lowest,
-		 use_geno_probs, use_haplotypes);
+    /* genotypes with alleles other than 0 and 1 were read as missing,
+     * so rather than writing them as missing, skip the record
+     */
+    for(j = 0; j < n_lowest; j++) {
+      if(use_haplotypes && f_info[lowest[j]].cur_snp->has_other_alleles) {
+	break;
+      }
+    }
+    if(j < n_lowest) {
+      n_other += 1;
+    } else {
+      /* merge counts and write line for these SNPs */
+      write_output(w, f_info, n_vcf, is_lowest, lowest, format_str,
+		   use_geno_probs, use_haplotypes, use_dosages);
+    }
     
-    /* advance files with lowest SNPs */
-    for(i = 0; i < n_vcf; i++) {
-      if(!f_info[i].is_done && is_lowest[i]) {
-	if(vcf_read_line(f_info[i].gzf, f_info[i].vcf, &f_info[i].cur_snp) == -1) {
-	  /* have reached end of this file */
-	  n_done += 1;
-	  f_info[i].is_done = TRUE;
-	}
+    /* advance files with lowest SNPs and put them back in heap */
+    for(j = 0; j < n_lowest; j++) {
+      i = lowest[j];
+      is_lowest[i] = FALSE;
+      
+      if(read_merge_snp(&f_info[i], chrom_tab, &n_skip) == -1) {
+	/* have reached end of this file */
+	n_done += 1;
+	f_info[i].is_done = TRUE;
+      } else {
+	file_heap_push(heap, f_info, i);
       }
     }
   }
   
+  if(n_skip > 0) {
+    fprintf(stderr, "skipped %ld records on chromosomes that are not "
+	    "present in all VCFs\n", n_skip);
+  }
+  if(n_other > 0) {
+    my_warn("%s:%d: skipped %ld records with genotypes that have alleles "
+	    "other than 0 and 1, which cannot be merged", __FILE__, __LINE__,
+	    n_other);
+  }
   fprintf(stderr, "done!\n");
 
+  writer_close(w);
   free_file_info(f_info, n_vcf);
   for(i = 0; i < n_chrom; i++) {
     my_free(chrom_tab[i].name);
@@ -347,6 +956,8 @@ void merge_vcf(int n_vcf, char **vcf_filenames) {
   }
   my_free(chrom_tab);
   my_free(is_lowest);
+  my_free(lowest);
+  file_heap_free(heap);
   
 }
 
@@ -354,19 +965,110 @@ void merge_vcf(int n_vcf, char **vcf_filenames) {
 
 
 int main(int argc, char **argv) {
-  int n_vcf;
-  char **vcf_filenames;
+  int n_vcf, c, n_threads, n_prefetch, n_parse_threads, n_batch;
+  int prob_src, dosage_type;
+  char **vcf_filenames, *region_str, *out_path, **sample_names;
+  long n_sample_names;
+
+  static struct option loptions[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"threads", required_argument, NULL, 't'},
+    {"region", required_argument, NULL, 'r'},
+    {"prefetch", required_argument, NULL, 'p'},
+    {"parse-threads", required_argument, NULL, 'j'},
+    {"batch", required_argument, NULL, 'b'},
+    {"geno-prob", required_argument, NULL, 'g'},
+    {"dosage", required_argument, NULL, 'd'},
+    {"samples", required_argument, NULL, 's'},
+    {"samples-file", required_argument, NULL, 'S'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  out_path = NULL;
+  n_threads = bgzf_default_threads();
+  region_str = NULL;
+  n_prefetch = 0;
+  n_parse_threads = 0;
+  n_batch = DEFAULT_BATCH_SIZE;
+  prob_src = VCF_PROB_AUTO;
+  dosage_type = VCF_DOSAGE_NONE;
+  sample_names = NULL;
+  n_sample_names = 0;
+
+  while((c = getopt_long(argc, argv, "o:t:r:p:j:b:g:d:s:S:h", loptions, NULL)) != -1) {
+    switch(c) {
+    case 'o':
+      out_path = optarg;
+      break;
+    case 't':
+      n_threads = util_parse_long(optarg);
+      break;
+    case 'r':
+      region_str = optarg;
+      break;
+    case 'p':
+      n_prefetch = util_parse_long(optarg);
+      break;
+    case 'j':
+      n_parse_threads = util_parse_long(optarg);
+      break;
+    case 'b':
+      n_batch = util_parse_long(optarg);
+      break;
+    case 'g':
+      prob_src = vcf_parse_prob_source(optarg);
+      if(prob_src == -1) {
+	my_err("%s:%d: unknown genotype probability field '%s', expected "
+	       "auto, GL, PL or GP", __FILE__, __LINE__, optarg);
+      }
+      break;
+    case 'd':
+      dosage_type = vcf_parse_dosage_type(optarg);
+      if(dosage_type == -1) {
+	my_err("%s:%d: unknown dosage type '%s', expected none, "
+	       "float, half or uint8", __FILE__, __LINE__, optarg);
+      }
+      break;
+    case 's':
+    case 'S':
+      if(sample_names) {
+	my_err("%s:%d: samples can only be given once", __FILE__, __LINE__);
+      }
+      sample_names = (c == 's') ?
+	vcf_parse_sample_list(optarg, &n_sample_names) :
+	vcf_read_sample_file(optarg, &n_sample_names);
+      break;
+    case 'h':
+      usage(argv);
+      exit(0);
+    default:
+      usage(argv);
+      exit(255);
+    }
+  }
 
-  n_vcf = argc-1;
+  n_vcf = argc - optind;
 
   if(n_vcf < 2) {
     usage(argv);
     exit(255);
   }
 
-  vcf_filenames = &argv[1];
+  if(n_parse_threads > 0 && (region_str || n_prefetch > 0)) {
+    my_err("%s:%d: --parse-threads cannot be used with --region or "
+	   "--prefetch", __FILE__, __LINE__);
+  }
+
+  vcf_filenames = &argv[optind];
   
-  merge_vcf(n_vcf, vcf_filenames);
+  merge_vcf(n_vcf, vcf_filenames, out_path, n_threads, region_str,
+	    n_prefetch, n_parse_threads, n_batch, prob_src, dosage_type,
+	    sample_names, n_sample_names);
+
+  if(sample_names) {
+    vcf_free_sample_list(sample_names, n_sample_names);
+  }
 
   fprintf(stderr, "done\n");
   
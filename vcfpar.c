@@ -0,0 +1,297 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "vcfpar.h"
+#include "vcf.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+
+
+/**
+ * Copies up to VCFPAR_CHUNK_LINES lines from the reader into the
+ * chunk. Sets vp->at_eof if the end of the file is reached. Must be
+ * called with read_lock held.
+ */
+static void vcfpar_fill(VCFPar *vp, VCFParChunk *chunk) {
+  const char *line;
+  long len;
+
+  chunk->n_line = 0;
+  chunk->buf_len = 0;
+
+  while(chunk->n_line < VCFPAR_CHUNK_LINES) {
+    len = reader_getline(vp->rd, &line);
+    if(len == -1) {
+      pthread_mutex_lock(&vp->lock);
+      vp->at_eof = TRUE;
+      pthread_cond_signal(&vp->not_empty);
+      pthread_mutex_unlock(&vp->lock);
+      break;
+    }
+
+    while(chunk->buf_len + len + 1 > chunk->buf_size) {
+      chunk->buf_size *= 2;
+      chunk->buf = my_realloc(chunk->buf, chunk->buf_size);
+    }
+    memcpy(&chunk->buf[chunk->buf_len], line, len);
+    chunk->buf[chunk->buf_len + len] = '\0';
+
+    chunk->line_off[chunk->n_line] = chunk->buf_len;
+    chunk->line_len[chunk->n_line] = len;
+    chunk->buf_len += len + 1;
+    chunk->n_line += 1;
+  }
+}
+
+
+
+/**
+ * Parses the lines of a chunk into its records
+ */
+static void vcfpar_parse(VCFInfo *vcf, VCFParChunk *chunk) {
+  long i;
+
+  for(i = 0; i < chunk->n_line; i++) {
+    vcf->buf = &chunk->buf[chunk->line_off[i]];
+    vcf->line_len = chunk->line_len[i];
+    vcf_parse_line(vcf, &chunk->snps[i]);
+  }
+}
+
+
+
+/**
+ * Worker thread: repeatedly fills the next free chunk with lines
+ * (one worker at a time) and then parses it (in parallel with other
+ * workers) until the end of the file is reached.
+ */
+static void *vcfpar_worker(void *data) {
+  VCFParWorker *w;
+  VCFPar *vp;
+  VCFParChunk *chunk;
+
+  w = data;
+  vp = w->vp;
+
+  while(TRUE) {
+    pthread_mutex_lock(&vp->read_lock);
+
+    pthread_mutex_lock(&vp->lock);
+    while(!vp->shutdown && !vp->at_eof &&
+	  (vp->tail - vp->head) >= vp->n_chunk) {
+      pthread_cond_wait(&vp->not_full, &vp->lock);
+    }
+    if(vp->shutdown || vp->at_eof) {
+      pthread_mutex_unlock(&vp->lock);
+      pthread_mutex_unlock(&vp->read_lock);
+      break;
+    }
+    /* chunk is not visible to consumer until it has been parsed */
+    chunk = &vp->chunks[vp->tail % vp->n_chunk];
+    chunk->is_parsed = FALSE;
+    vp->tail += 1;
+    pthread_mutex_unlock(&vp->lock);
+
+    vcfpar_fill(vp, chunk);
+    pthread_mutex_unlock(&vp->read_lock);
+
+    vcfpar_parse(w->vcf, chunk);
+
+    pthread_mutex_lock(&vp->lock);
+    chunk->is_parsed = TRUE;
+    pthread_cond_signal(&vp->not_empty);
+    pthread_mutex_unlock(&vp->lock);
+  }
+
+  return NULL;
+}
+
+
+
+/**
+ * Starts n_worker threads that read lines from rd and parse them
+ * into records. The header must already have been read into vcf.
+ * arrays is a combination of VCFPAR_HAPLOTYPES, VCFPAR_PACKED_HAPS,
+ * VCFPAR_GENO_PROBS and VCFPAR_DOSAGES flags that says which
+ * genotype arrays are allocated for each record. The reader and vcf
+ * must not be used by the caller until vcfpar_free is called.
+ */
+VCFPar *vcfpar_new(Reader *rd, VCFInfo *vcf, int n_worker, int arrays) {
+  VCFPar *vp;
+  VCFParChunk *chunk;
+  SNP *snp;
+  int i, j;
+
+  if(n_worker < 1) {
+    my_err("%s:%d: at least 1 parse thread is required",
+	   __FILE__, __LINE__);
+  }
+
+  vp = my_new(VCFPar, 1);
+  vp->rd = rd;
+  vp->vcf = vcf;
+
+  vp->n_chunk = n_worker * VCFPAR_CHUNKS_PER_THREAD;
+  vp->chunks = my_new(VCFParChunk, vp->n_chunk);
+  for(i = 0; i < vp->n_chunk; i++) {
+    chunk = &vp->chunks[i];
+    chunk->buf_size = VCFPAR_CHUNK_BUF_SZ;
+    chunk->buf = my_malloc(chunk->buf_size);
+    chunk->buf_len = 0;
+    chunk->n_line = 0;
+    chunk->is_parsed = FALSE;
+
+    for(j = 0; j < VCFPAR_CHUNK_LINES; j++) {
+      snp = &chunk->snps[j];
+      snp_init(snp);
+      if(arrays & VCFPAR_HAPLOTYPES) {
+	snp->haplotypes = my_malloc(sizeof(char) * vcf->n_haplo_col);
+      }
+      if(arrays & VCFPAR_PACKED_HAPS) {
+	snp->packed_haps = my_malloc(SNP_PACKED_SIZE(vcf->n_haplo_col));
+      }
+      if(arrays & (VCFPAR_HAPLOTYPES | VCFPAR_PACKED_HAPS)) {
+	snp->unphased = my_malloc(SNP_UNPHASED_SIZE(vcf->n_samples));
+      }
+      if(arrays & VCFPAR_GENO_PROBS) {
+	snp->geno_probs = my_malloc(sizeof(float) * vcf->n_geno_prob_col);
+      }
+      if(arrays & VCFPAR_DOSAGES) {
+	snp->dosages = my_malloc(vcf_dosage_size(vcf->dosage_type) *
+				 vcf->n_samples);
+      }
+    }
+  }
+  vp->head = vp->tail = 0;
+  vp->cur_rec = 0;
+  vp->at_eof = FALSE;
+  vp->shutdown = FALSE;
+
+  pthread_mutex_init(&vp->read_lock, NULL);
+  pthread_mutex_init(&vp->lock, NULL);
+  pthread_cond_init(&vp->not_full, NULL);
+  pthread_cond_init(&vp->not_empty, NULL);
+
+  vp->n_worker = n_worker;
+  vp->workers = my_new(VCFParWorker, n_worker);
+  for(i = 0; i < n_worker; i++) {
+    vp->workers[i].vp = vp;
+    /* records are only used while their chunk is held by the
+     * consumer, so fixed columns can be views into the chunk
+     */
+    vp->workers[i].vcf = vcf_info_clone(vcf);
+    vcf_set_record_mode(vp->workers[i].vcf, VCF_RECORD_VIEW);
+    /* unknown chromosomes are warned about once by vcfpar_next */
+    vp->workers[i].vcf->warn_chrom = FALSE;
+  }
+  for(i = 0; i < n_worker; i++) {
+    if(pthread_create(&vp->workers[i].thread, NULL, vcfpar_worker,
+		      &vp->workers[i]) != 0) {
+      my_err("%s:%d: could not create thread", __FILE__, __LINE__);
+    }
+  }
+
+  return vp;
+}
+
+
+
+/**
+ * Returns the next record in file order, waiting for workers if
+ * necessary, or NULL if there are no more records. The returned SNP
+ * is only valid until the next call to this function. Per-record
+ * fields of the VCFInfo (e.g. qual and info) are not set.
+ */
+SNP *vcfpar_next(VCFPar *vp) {
+  VCFParChunk *chunk;
+  SNP *snp;
+
+  pthread_mutex_lock(&vp->lock);
+
+  while(TRUE) {
+    if(vp->head < vp->tail) {
+      chunk = &vp->chunks[vp->head % vp->n_chunk];
+
+      if(chunk->is_parsed) {
+	if(vp->cur_rec < chunk->n_line) {
+	  snp = &chunk->snps[vp->cur_rec];
+	  vp->cur_rec += 1;
+	  break;
+	}
+	/* all records of chunk have been used, give it back */
+	vp->head += 1;
+	vp->cur_rec = 0;
+	pthread_cond_signal(&vp->not_full);
+	continue;
+      }
+    } else if(vp->at_eof) {
+      snp = NULL;
+      break;
+    }
+
+    pthread_cond_wait(&vp->not_empty, &vp->lock);
+  }
+
+  pthread_mutex_unlock(&vp->lock);
+
+  if(snp && snp->chrom_id == -1) {
+    vcf_chrom_id(vp->vcf, snp->chrom_name.str, snp->chrom_name.len);
+  }
+
+  return snp;
+}
+
+
+
+/**
+ * Stops worker threads and frees memory. The reader and VCFInfo are
+ * not freed.
+ */
+void vcfpar_free(VCFPar *vp) {
+  VCFParChunk *chunk;
+  SNP *snp;
+  int i, j;
+
+  pthread_mutex_lock(&vp->lock);
+  vp->shutdown = TRUE;
+  pthread_cond_broadcast(&vp->not_full);
+  pthread_mutex_unlock(&vp->lock);
+
+  for(i = 0; i < vp->n_worker; i++) {
+    pthread_join(vp->workers[i].thread, NULL);
+    vcf_info_free(vp->workers[i].vcf);
+  }
+  my_free(vp->workers);
+
+  pthread_mutex_destroy(&vp->read_lock);
+  pthread_mutex_destroy(&vp->lock);
+  pthread_cond_destroy(&vp->not_full);
+  pthread_cond_destroy(&vp->not_empty);
+
+  for(i = 0; i < vp->n_chunk; i++) {
+    chunk = &vp->chunks[i];
+    for(j = 0; j < VCFPAR_CHUNK_LINES; j++) {
+      snp = &chunk->snps[j];
+      if(snp->haplotypes) {
+	my_free(snp->haplotypes);
+      }
+      if(snp->packed_haps) {
+	my_free(snp->packed_haps);
+      }
+      if(snp->unphased) {
+	my_free(snp->unphased);
+      }
+      if(snp->geno_probs) {
+	my_free(snp->geno_probs);
+      }
+      if(snp->dosages) {
+	my_free(snp->dosages);
+      }
+    }
+    my_free(chunk->buf);
+  }
+  my_free(vp->chunks);
+  my_free(vp);
+}
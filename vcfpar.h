@@ -0,0 +1,101 @@
+#ifndef __VCFPAR_H__
+#define __VCFPAR_H__
+
+#include <pthread.h>
+
+#include "vcf.h"
+#include "snp.h"
+#include "reader.h"
+
+/* genotype arrays that are allocated for each record */
+#define VCFPAR_HAPLOTYPES 1
+#define VCFPAR_PACKED_HAPS 2
+#define VCFPAR_GENO_PROBS 4
+#define VCFPAR_DOSAGES 8
+
+/* maximum number of records in a chunk */
+#define VCFPAR_CHUNK_LINES 64
+
+/* initial size of chunk line buffer, grows if lines are longer */
+#define VCFPAR_CHUNK_BUF_SZ (256 * 1024)
+
+/* number of chunks in ring for each worker thread */
+#define VCFPAR_CHUNKS_PER_THREAD 2
+
+
+/**
+ * A chunk of consecutive lines of the file, and the records that
+ * they are parsed into
+ */
+typedef struct {
+  char *buf;
+  size_t buf_size;
+  size_t buf_len;
+
+  /* lines are '\0'-terminated and start at buf[line_off[i]] */
+  long n_line;
+  size_t line_off[VCFPAR_CHUNK_LINES];
+  long line_len[VCFPAR_CHUNK_LINES];
+
+  /* fixed columns of records are views into buf */
+  SNP snps[VCFPAR_CHUNK_LINES];
+
+  int is_parsed;
+} VCFParChunk;
+
+
+struct VCFPar_struct;
+
+typedef struct {
+  struct VCFPar_struct *vp;
+
+  /* worker's own copy of header information and format layout */
+  VCFInfo *vcf;
+  pthread_t thread;
+} VCFParWorker;
+
+
+/**
+ * Parses records of a single VCF on several worker threads. The
+ * decompressed stream is split into chunks of whole lines, which
+ * workers take in turn to parse. Records are returned from chunks in
+ * file order.
+ */
+typedef struct VCFPar_struct {
+  Reader *rd;
+  VCFInfo *vcf;
+
+  /* ring of chunks, indexed by sequence number modulo n_chunk. head
+   * is the chunk that records are returned from and tail is the next
+   * chunk that will be filled
+   */
+  int n_chunk;
+  VCFParChunk *chunks;
+  long head;
+  long tail;
+
+  /* index of next record to return from head chunk */
+  long cur_rec;
+
+  int n_worker;
+  VCFParWorker *workers;
+
+  int at_eof;
+  int shutdown;
+
+  /* held by the worker that is reading lines into a chunk, so
+   * that chunks are filled in order
+   */
+  pthread_mutex_t read_lock;
+
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
+} VCFPar;
+
+
+VCFPar *vcfpar_new(Reader *rd, VCFInfo *vcf, int n_worker, int arrays);
+SNP *vcfpar_next(VCFPar *vp);
+void vcfpar_free(VCFPar *vp);
+
+#endif
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+
+#include "writer.h"
+#include "memutil.h"
+#include "util.h"
+#include "err.h"
+
+
+
+/**
+ * Creates a new writer that writes to an already-opened file. The
+ * file is flushed but not closed by writer_close.
+ */
+Writer *writer_new(FILE *fh) {
+  Writer *w;
+
+  w = my_new(Writer, 1);
+  w->fh = fh;
+  w->own_fh = FALSE;
+  w->path = NULL;
+  w->bgzf = NULL;
+
+  w->buf_size = WRITER_BUF_SZ;
+  w->buf = my_malloc(w->buf_size);
+  w->len = 0;
+
+  return w;
+}
+
+
+/**
+ * Opens a file for writing. If path is NULL or "-", output is
+ * written to stdout. If path ends with .gz, output is BGZF
+ * compressed using n_threads worker threads (or by the calling
+ * thread if n_threads is 0).
+ */
+Writer *writer_open(const char *path, int n_threads) {
+  Writer *w;
+
+  if(path == NULL || strcmp(path, "-") == 0) {
+    return writer_new(stdout);
+  }
+
+  if(util_has_gz_ext(path)) {
+    w = writer_new(NULL);
+    w->bgzf = bgzf_writer_open(path, Z_DEFAULT_COMPRESSION, n_threads);
+    w->path = util_str_dup(path);
+    return w;
+  }
+
+  w = writer_new(util_must_fopen(path, "wb"));
+  w->own_fh = TRUE;
+  w->path = util_str_dup(path);
+
+  return w;
+}
+
+
+/**
+ * Writes all buffered data to the file
+ */
+void writer_flush(Writer *w) {
+  if(w->len > 0) {
+    if(w->bgzf) {
+      bgzf_write(w->bgzf, w->buf, w->len);
+    } else {
+      util_must_fwrite(w->fh, w->buf, w->len);
+    }
+    w->len = 0;
+  }
+}
+
+
+/**
+ * Flushes buffered data, closes the file if it was opened by
+ * writer_open and frees memory.
+ */
+void writer_close(Writer *w) {
+  writer_flush(w);
+
+  if(w->bgzf) {
+    bgzf_writer_close(w->bgzf);
+    my_free(w->path);
+  } else if(w->own_fh) {
+    if(fclose(w->fh) != 0) {
+      my_err("%s:%d: error closing file '%s'", __FILE__, __LINE__,
+	     w->path);
+    }
+    my_free(w->path);
+  } else if(fflush(w->fh) != 0) {
+    my_err("%s:%d: error flushing output", __FILE__, __LINE__);
+  }
+
+  my_free(w->buf);
+  my_free(w);
+}
+
+
+/**
+ * Returns a pointer to at least n characters of free space at the
+ * end of the buffer, flushing or growing the buffer if necessary.
+ * Characters that are written there become part of the output when
+ * writer_commit is called.
+ */
+char *writer_reserve(Writer *w, size_t n) {
+  if(w->len + n > w->buf_size) {
+    writer_flush(w);
+
+    if(n > w->buf_size) {
+      while(n > w->buf_size) {
+	w->buf_size *= 2;
+      }
+      w->buf = my_realloc(w->buf, w->buf_size);
+    }
+  }
+  return &w->buf[w->len];
+}
+
+
+/**
+ * Adds n characters that were written to space returned by
+ * writer_reserve to the output
+ */
+void writer_commit(Writer *w, size_t n) {
+  w->len += n;
+}
+
+
+void writer_write(Writer *w, const char *data, size_t len) {
+  memcpy(writer_reserve(w, len), data, len);
+  w->len += len;
+}
+
+
+void writer_puts(Writer *w, const char *str) {
+  writer_write(w, str, strlen(str));
+}
+
+
+void writer_putc(Writer *w, char c) {
+  *writer_reserve(w, 1) = c;
+  w->len += 1;
+}
+
+
+void writer_put_long(Writer *w, long x) {
+  w->len += writer_fmt_long(writer_reserve(w, WRITER_MAX_NUM_LEN), x);
+}
+
+
+/**
+ * Writes the decimal representation of x to dest (without a
+ * terminating '\0') and returns the number of characters written,
+ * which is at most WRITER_MAX_NUM_LEN.
+ */
+int writer_fmt_long(char *dest, long x) {
+  char tmp[WRITER_MAX_NUM_LEN];
+  unsigned long u;
+  int n, len;
+
+  len = 0;
+  if(x < 0) {
+    dest[len++] = '-';
+    u = -(unsigned long)x;
+  } else {
+    u = x;
+  }
+
+  /* digits are generated in reverse order */
+  n = 0;
+  do {
+    tmp[n++] = '0' + (u % 10);
+    u /= 10;
+  } while(u > 0);
+
+  while(n > 0) {
+    dest[len++] = tmp[--n];
+  }
+  return len;
+}
+
+
+/**
+ * Writes x to dest rounded to n_dec decimal places (at most
+ * WRITER_MAX_DEC), without trailing zeros after the decimal point,
+ * e.g. 0.25, 1 or 0.333. NaN is written as '.', the VCF missing
+ * value. Returns the number of characters written, which is at most
+ * WRITER_MAX_NUM_LEN. No terminating '\0' is written.
+ */
+int writer_fmt_fixed(char *dest, float x, int n_dec) {
+  char tmp[WRITER_MAX_NUM_LEN];
+  long scale, v, frac;
+  int i, len;
+
+  if(isnan(x)) {
+    dest[0] = '.';
+    return 1;
+  }
+  if(fabs(x) >= WRITER_FIXED_MAX) {
+    /* rare, so just use printf */
+    len = snprintf(tmp, sizeof(tmp), "%g", x);
+    memcpy(dest, tmp, len);
+    return len;
+  }
+  if(n_dec > WRITER_MAX_DEC) {
+    n_dec = WRITER_MAX_DEC;
+  }
+
+  scale = 1;
+  for(i = 0; i < n_dec; i++) {
+    scale *= 10;
+  }
+  v = lround((double)x * scale);
+
+  len = 0;
+  if(v < 0) {
+    dest[len++] = '-';
+    v = -v;
+  }
+  len += writer_fmt_long(&dest[len], v / scale);
+
+  frac = v % scale;
+  if(frac > 0) {
+    /* drop trailing zeros */
+    while(frac % 10 == 0) {
+      frac /= 10;
+      n_dec--;
+    }
+    dest[len++] = '.';
+    for(i = n_dec - 1; i >= 0; i--) {
+      dest[len + i] = '0' + (frac % 10);
+      frac /= 10;
+    }
+    len += n_dec;
+  }
+  return len;
+}
@@ -0,0 +1,64 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <stdio.h>
+
+#include "bgzf.h"
+
+/* size of writer buffer, which grows if more space is reserved at once */
+#define WRITER_BUF_SZ (4 * 1024 * 1024)
+
+/* maximum number of characters written by writer_fmt_long and
+ * writer_fmt_fixed
+ */
+#define WRITER_MAX_NUM_LEN 24
+
+/* numbers with at least this magnitude are not written in fixed-point,
+ * which can have at most WRITER_MAX_DEC decimal places
+ */
+#define WRITER_FIXED_MAX 1e9
+#define WRITER_MAX_DEC 9
+
+
+/**
+ * Block-buffered output. Text is accumulated in buf and written to
+ * the file in large chunks. Callers that format many fields can
+ * reserve space in the buffer with writer_reserve, write directly
+ * into it and then commit the number of characters they used.
+ *
+ * Files with a .gz extension are written in BGZF format by a
+ * BGZFWriter, which can deflate blocks on several threads.
+ */
+typedef struct {
+  FILE *fh;
+  int own_fh;
+  char *path;
+
+  /* compresses output if non-NULL, in which case fh is not used */
+  BGZFWriter *bgzf;
+
+  char *buf;
+  size_t buf_size;
+
+  /* number of characters in buf that have not been written yet */
+  size_t len;
+} Writer;
+
+
+Writer *writer_new(FILE *fh);
+Writer *writer_open(const char *path, int n_threads);
+void writer_close(Writer *w);
+void writer_flush(Writer *w);
+
+char *writer_reserve(Writer *w, size_t n);
+void writer_commit(Writer *w, size_t n);
+
+void writer_write(Writer *w, const char *data, size_t len);
+void writer_puts(Writer *w, const char *str);
+void writer_putc(Writer *w, char c);
+void writer_put_long(Writer *w, long x);
+
+int writer_fmt_long(char *dest, long x);
+int writer_fmt_fixed(char *dest, float x, int n_dec);
+
+#endif